@@ -0,0 +1,137 @@
+// Lexer throughput in MB/s, at every simd level the cpu supports
+// Built-in sources are punctuation heavy and identifier heavy code, files given on the command line are added to them
+// Token start dispatch (char_class.hpp, punctuators.hpp) dominates the first, the scanners the second
+// Usage: lexer_bench [file...]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "cppi/tokenize.hpp"
+#include "cppi/lexer_scan.hpp"
+#include "cppi/source.hpp"
+
+using namespace cppi;
+
+struct bench_source {
+    std::string name;
+    std::string data;
+};
+
+static const char* level_name(simd_level level) {
+    switch(level) {
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+// Short tokens and operators, most token starts are punctuators
+static std::string punctuation_source(size_t size) {
+    static const char* lines[] = {
+        "x=a[i]+b[j]*c-(d<<2)|e&~f^g;\n",
+        "if(p->q!=r&&s<=t||!u){v+=w;w-=1;}\n",
+        "y=(a>b)?a:b;z%=3;k>>=1;m<<=n;\n",
+        "for(i=0;i<n;++i){s+=v[i]*v[i];}\n",
+        "o.*pm=0;o->*pm=1;q<=>r;h::k<1>();\n",
+        "#define M(a,b) a##b #a\n",
+    };
+    std::string str;
+    for(size_t i = 0; str.size() < size; ++i) {
+        str += lines[i % (sizeof(lines) / sizeof(lines[0]))];
+    }
+    return str;
+}
+
+// Long identifiers, whitespace, comments and literals, the scanners cover most bytes
+static std::string identifier_source(size_t size) {
+    static const char* lines[] = {
+        "    const some_namespace::long_type_name& reference_to_something = other_object.member_function(argument_value);\n",
+        "    // a line comment that runs for a while before it reaches the end of the line\n",
+        "    static const char* message_text = \"a string literal of a reasonable length\";\n",
+        "    /* a block comment\n       over two lines */\n",
+        "    unsigned long long counter_value = 1234567890 + 9876543210;\n",
+    };
+    std::string str;
+    for(size_t i = 0; str.size() < size; ++i) {
+        str += lines[i % (sizeof(lines) / sizeof(lines[0]))];
+    }
+    return str;
+}
+
+static bool read_file(const char* path, std::string& data) {
+    FILE* f = fopen(path, "rb");
+    if(!f) {
+        printf("can't open %s\n", path);
+        return false;
+    }
+    char buf[64 * 1024];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), f)) != 0) {
+        data.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+// Best of several rounds, each round lexes the source as often as fits in about 100 ms
+static double measure(source_id file, size_t size) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<token> tokens;
+    double best = 0;
+    for(int round = 0; round < 5; ++round) {
+        size_t bytes = 0;
+        auto start = clock::now();
+        double seconds = 0;
+        while(seconds < 0.1) {
+            tokens.clear();
+            tokenize(file, tokens);
+            bytes += size;
+            seconds = std::chrono::duration<double>(clock::now() - start).count();
+        }
+        double mbps = bytes / seconds / (1024 * 1024);
+        if(mbps > best) {
+            best = mbps;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    std::vector<bench_source> sources;
+    sources.push_back({ "punctuation", punctuation_source(4 * 1024 * 1024) });
+    sources.push_back({ "identifiers", identifier_source(4 * 1024 * 1024) });
+    for(int i = 1; i < argc; ++i) {
+        bench_source src;
+        src.name = argv[i];
+        if(!read_file(argv[i], src.data)) {
+            return 1;
+        }
+        sources.push_back(src);
+    }
+
+    simd_level best = best_simd_level();
+    printf("%-24s %10s", "source", "size");
+    for(int level = SIMD_NONE; level <= best; ++level) {
+        printf(" %10s", level_name((simd_level)level));
+    }
+    printf("   (MB/s)\n");
+    for(auto& src : sources) {
+        source_id file = register_source(src.data.data(), src.data.size(), src.name.c_str());
+        if(file == source_none) {
+            return 1;
+        }
+        printf("%-24s %10d", src.name.c_str(), (int)src.data.size());
+        for(int level = SIMD_NONE; level <= best; ++level) {
+            set_lexer_simd_level((simd_level)level);
+            printf(" %10.1f", measure(file, src.data.size()));
+            fflush(stdout);
+        }
+        printf("\n");
+        release_source(file);
+    }
+    set_lexer_simd_level(best);
+    return 0;
+}
@@ -0,0 +1,170 @@
+// Scaling of tokenize_parallel() against tokenize() on one large source
+// Each thread count is timed on the same source and its tokens are checked against the sequential ones,
+// the chunks are also lexed one after another to time each on its own, which is what a core per chunk would give
+// The source is generated code of about 32 MB, or the file given on the command line
+// Usage: tokenize_bench [file]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#include "cppi/tokenize.hpp"
+#include "cppi/source.hpp"
+
+using namespace cppi;
+
+// xorshift, fixed seed so runs are the same
+static uint32_t rng_state = 0x9E3779B9u;
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Mix of code, comments, strings and splices in random order, so chunks start inside block comments,
+// next to ones that open or close across a splice, and after quotes and comment markers in strings and comments
+static std::string generated_source(size_t size) {
+    static const char* lines[] = {
+        "static int function_name(const char* argument, size_t length) {\n",
+        "    for(size_t i = 0; i < length; ++i) { total += argument[i] * 31; }\n",
+        "    /* block comment\n       that spans\n       a few lines */\n",
+        "    /** doc comment **\n     * with stars\n     **/ int after_comment;\n",
+        "    /\\\n* opened and closed across splices *\\\n/ x = y / z;\n",
+        "    // line comment with a splice \\\n       that goes on here /* not a comment\n",
+        "    const char* text = \"string literal, with \\\"escapes\\\" and /* in it\";\n",
+        "    char q = '\"', a = '\\'', s = '/';\n",
+        "#define MACRO(a, b) ((a) < (b) ? (b) : (a))\n",
+        "    return MACRO(total, 0x7FFFFFFF) >> 3;\n}\n",
+    };
+    std::string str;
+    while(str.size() < size) {
+        str += lines[rng() % (sizeof(lines) / sizeof(lines[0]))];
+    }
+    return str;
+}
+
+static bool read_file(const char* path, std::string& data) {
+    FILE* f = fopen(path, "rb");
+    if(!f) {
+        printf("can't open %s\n", path);
+        return false;
+    }
+    char buf[64 * 1024];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), f)) != 0) {
+        data.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool same_tokens(const std::vector<token>& a, const std::vector<token>& b) {
+    if(a.size() != b.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); ++i) {
+        if(a[i].type != b[i].type || a[i].offset != b[i].offset
+            || a[i].length != b[i].length || a[i].atom != b[i].atom
+        ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Best of five, in seconds, thread_count 0 is plain tokenize()
+// Into a new vector every round, as for a source that is lexed once, so both pay for touching new memory
+static double measure(
+    source_id file, unsigned thread_count, std::vector<token>& tokens, tokenize_parallel_stats* stats = 0
+) {
+    typedef std::chrono::steady_clock clock;
+    double best = 0;
+    for(int round = 0; round < 5; ++round) {
+        std::vector<token>().swap(tokens);
+        auto start = clock::now();
+        if(thread_count == 0) {
+            tokenize(file, tokens);
+        } else {
+            tokenize_parallel(file, tokens, false, false, thread_count, stats);
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        if(round == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    std::string data;
+    const char* name = "generated";
+    if(argc > 1) {
+        name = argv[1];
+        if(!read_file(argv[1], data)) {
+            return 1;
+        }
+    } else {
+        data = generated_source(32 * 1024 * 1024);
+    }
+    if(data.size() < PARALLEL_TOKENIZE_MIN_SIZE) {
+        printf("%s is smaller than PARALLEL_TOKENIZE_MIN_SIZE, it is never split\n", name);
+    }
+    source_id file = register_source(data.data(), data.size(), name);
+    if(file == source_none) {
+        return 1;
+    }
+
+    double mb = data.size() / (1024.0 * 1024.0);
+    unsigned cores = std::thread::hardware_concurrency();
+    printf("%s, %.1f MB, %u hardware threads\n", name, mb, cores);
+    std::vector<token> expected;
+    double base = measure(file, 0, expected);
+    printf("%-12s %10.1f MB/s\n", "tokenize", mb / base);
+
+    // Measured is the wall time on this machine, threads beyond the number of cores share them
+    // Projected adds the pre-scan and the join to the slowest chunk lexed on its own, it leaves out
+    // starting the threads and memory bandwidth, so it's an upper bound that has to be checked on a machine with the cores
+    printf("%-12s %12s %8s %12s %8s %9s %9s %9s\n",
+        "", "measured", "", "projected", "", "pre-scan", "slowest", "join");
+    bool ok = true;
+    static const unsigned thread_counts[] = { 1, 2, 4, 8 };
+    for(unsigned thread_count : thread_counts) {
+        std::vector<token> tokens;
+        double seconds = measure(file, thread_count, tokens);
+        bool same = same_tokens(expected, tokens);
+        tokenize_parallel_stats stats;
+        stats.serial = true;
+        measure(file, thread_count, tokens, &stats);
+        same = same && same_tokens(expected, tokens) && stats.relexed_chunks == 0;
+        double projected = thread_count < 2 ? seconds : stats.prescan_seconds + stats.max_chunk_seconds + stats.join_seconds;
+        printf(
+            "%2u thread%s   %7.1f MB/s %5.2fx %7.1f MB/s %5.2fx %7.1f ms %6.1f ms %6.1f ms%s%s\n",
+            thread_count, thread_count == 1 ? " " : "s", mb / seconds, base / seconds,
+            mb / projected, base / projected,
+            stats.prescan_seconds * 1000, stats.max_chunk_seconds * 1000, stats.join_seconds * 1000,
+            thread_count > cores ? "  (more threads than cores)" : "", same ? "" : "  TOKENS DIFFER"
+        );
+        ok = ok && same;
+    }
+
+    // Chunk starts at many more places, not timed
+    unsigned checked = 0;
+    for(unsigned thread_count = 3; thread_count <= 64; ++thread_count) {
+        std::vector<token> tokens;
+        tokenize_parallel_stats stats;
+        stats.serial = true;
+        tokenize_parallel(file, tokens, false, false, thread_count, &stats);
+        if(!same_tokens(expected, tokens) || stats.relexed_chunks != 0) {
+            printf("%u threads: tokens differ, %u chunks lexed again\n", thread_count, stats.relexed_chunks);
+            ok = false;
+        }
+        checked += stats.chunks;
+    }
+    printf("%u chunk starts from 3 to 64 threads %s\n", checked, ok ? "match tokenize()" : "DIFFER");
+    release_source(file);
+    return ok ? 0 : 1;
+}
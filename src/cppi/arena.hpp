@@ -0,0 +1,72 @@
+#ifndef CPPI_ARENA_HPP
+#define CPPI_ARENA_HPP
+
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+
+
+namespace cppi {
+
+// Read-only array living in an arena
+template<typename T>
+struct arena_span {
+    const T* items = 0;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t i) const { return items[i]; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+};
+
+// Bump allocator, memory is never moved and is only released all at once
+class arena {
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t chunk_size = 0;
+    size_t chunk_used = 0;
+public:
+    void* alloc(size_t size, size_t align = alignof(max_align_t)) {
+        size_t offset = (chunk_used + align - 1) & ~(align - 1);
+        if(chunks.empty() || offset + size > chunk_size) {
+            chunk_size = size + align > CHUNK_SIZE ? size + align : CHUNK_SIZE;
+            chunks.push_back(std::unique_ptr<char[]>(new char[chunk_size]));
+            // new char[] is aligned for any fundamental type
+            offset = 0;
+        }
+        chunk_used = offset + size;
+        return chunks.back().get() + offset;
+    }
+    // T must be trivially copyable, destructors are never run
+    template<typename T>
+    arena_span<T> copy(const std::vector<T>& items) {
+        arena_span<T> span;
+        span.count = items.size();
+        if(!items.empty()) {
+            T* dst = (T*)alloc(sizeof(T) * items.size(), alignof(T));
+            memcpy(dst, items.data(), sizeof(T) * items.size());
+            span.items = dst;
+        }
+        return span;
+    }
+    const char* store(const char* str, size_t len) {
+        char* dst = (char*)alloc(len + 1, 1);
+        memcpy(dst, str, len);
+        dst[len] = '\0';
+        return dst;
+    }
+    void clear() {
+        chunks.clear();
+        chunk_size = 0;
+        chunk_used = 0;
+    }
+};
+
+} // cppi
+
+
+#endif
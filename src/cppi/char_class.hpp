@@ -0,0 +1,71 @@
+#ifndef CPPI_CHAR_CLASS_HPP
+#define CPPI_CHAR_CLASS_HPP
+
+#include <stdint.h>
+
+
+// What the lexer does with a character at the start of a token
+enum char_class : uint8_t {
+    cc_other,       // not part of any token, skipped
+    cc_end,         // '\0'
+    cc_space,       // ' ', '\t', '\r'
+    cc_newline,
+    cc_ident,       // letter or '_'
+    cc_digit,
+    cc_punct,       // first character of a punctuator, see punctuators.hpp
+    cc_dot,         // '.', '.5', '.*' or '...'
+    cc_slash,       // '/', '/=' or a comment
+    cc_dquote,
+    cc_squote
+};
+
+struct char_class_table {
+    char_class classes[256];
+};
+
+constexpr char_class_table make_char_class_table() {
+    char_class_table t = {};
+    for(int c = 0; c < 256; ++c) {
+        t.classes[c] = cc_other;
+    }
+    t.classes[0] = cc_end;
+    t.classes[' '] = cc_space;
+    t.classes['\t'] = cc_space;
+    t.classes['\r'] = cc_space;
+    t.classes['\n'] = cc_newline;
+    for(int c = 'a'; c <= 'z'; ++c) {
+        t.classes[c] = cc_ident;
+    }
+    for(int c = 'A'; c <= 'Z'; ++c) {
+        t.classes[c] = cc_ident;
+    }
+    t.classes['_'] = cc_ident;
+    for(int c = '0'; c <= '9'; ++c) {
+        t.classes[c] = cc_digit;
+    }
+    const char* punct = "{}[]()#=+-*%!<>&|~^,?:;";
+    for(const char* p = punct; *p; ++p) {
+        t.classes[(uint8_t)*p] = cc_punct;
+    }
+    t.classes['.'] = cc_dot;
+    t.classes['/'] = cc_slash;
+    t.classes['"'] = cc_dquote;
+    t.classes['\''] = cc_squote;
+    return t;
+}
+
+constexpr char_class_table char_classes = make_char_class_table();
+
+inline char_class get_char_class(char c) {
+    return char_classes.classes[(uint8_t)c];
+}
+inline bool is_space_char(char c) { return get_char_class(c) == cc_space; }
+inline bool is_digit_char(char c) { return get_char_class(c) == cc_digit; }
+inline bool is_ident_start_char(char c) { return get_char_class(c) == cc_ident; }
+inline bool is_ident_char(char c) {
+    char_class cls = get_char_class(c);
+    return cls == cc_ident || cls == cc_digit;
+}
+
+
+#endif
@@ -1,18 +1,41 @@
 #ifndef CPP_INSPECTOR_CONTEXT_HPP
 #define CPP_INSPECTOR_CONTEXT_HPP
 
+#include <memory>
+
 #include "pp_context.hpp"
 #include "options.hpp"
+#include "load_file.hpp"
 
 
 namespace cppi {
 
+struct parse_stats {
+    size_t memo_hits = 0; // rule re-scans avoided by the packrat memo
+    size_t memo_misses = 0;
+};
+
 class context {
+    // Tokens, macros and the source of the last parse point into it, replaced by the next parse(fname)
+    // Declared first, so it outlives pp_ctx
+    std::unique_ptr<mapped_file> root_file;
     pp_context pp_ctx;
+    bool bracket_index_mode = false;
+    bool packrat = false;
+    parse_stats stats;
 public:
     pp_context& get_preprocessor_context() { return pp_ctx; }
 
+    // Parse straight over the tokens, skipping bracket groups through their matching brackets,
+    // instead of building a tree of them first
+    void set_bracket_index_mode(bool enabled) { bracket_index_mode = enabled; }
+    // Remember rule results by position, so the declaration forms tried one after another
+    // at the same place don't scan the same specifiers and declarators again
+    void set_packrat(bool enabled) { packrat = enabled; }
+    const parse_stats& get_parse_stats() const { return stats; }
+
     bool parse(const char* fname);
+    // Tokens point into buffer, it has to outlive them, up to the next parse
     bool parse(const char* buffer, size_t length, const char* full_file_name_hint = ".");
 };
 
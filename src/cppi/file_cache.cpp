@@ -0,0 +1,310 @@
+#include "file_cache.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+
+#include "tokenize.hpp"
+#include "load_file.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+
+namespace cppi {
+
+static bool stat_file(const char* path, int64_t& mtime, uint64_t& size) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if(_stat64(path, &st) != 0) {
+        return false;
+    }
+#else
+    struct stat st;
+    if(stat(path, &st) != 0) {
+        return false;
+    }
+#endif
+    mtime = (int64_t)st.st_mtime;
+    size = (uint64_t)st.st_size;
+    return true;
+}
+
+bool canonical_path(const char* path, std::string& out) {
+#ifdef _WIN32
+    char buf[MAX_PATH];
+    if(!_fullpath(buf, path, MAX_PATH)) {
+        return false;
+    }
+    out = buf;
+    // Paths are case insensitive
+    for(auto& c : out) {
+        if(c == '/') c = '\\';
+        else if(c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+    }
+#else
+    char* buf = realpath(path, 0);
+    if(!buf) {
+        return false;
+    }
+    out = buf;
+    free(buf);
+#endif
+    return true;
+}
+
+bool detect_include_guard(const std::vector<token>& tokens, atom_t& guard) {
+    size_t i = 0;
+    auto is_tok = [&tokens, &i](token_type type) -> bool {
+        return i < tokens.size() && tokens[i].type == type;
+    };
+    auto eat_whitespace = [&is_tok, &i]() {
+        while(is_tok(tok_whitespace)) ++i;
+    };
+    auto eat_whitespace_and_newline = [&is_tok, &i]() {
+        while(is_tok(tok_whitespace) || is_tok(tok_newline)) ++i;
+    };
+    auto is_identifier = [&tokens, &is_tok, &i](atom_t name) -> bool {
+        return is_tok(tok_identifier) && tokens[i].atom == name;
+    };
+
+    // #ifndef X or #if !defined X or #if !defined(X) must come first
+    eat_whitespace_and_newline();
+    if(!is_tok(tok_hash)) return false;
+    ++i; eat_whitespace();
+    bool parenthesized = false;
+    if(is_identifier(atom_ifndef)) {
+        ++i; eat_whitespace();
+    } else if(is_identifier(atom_if)) {
+        ++i; eat_whitespace();
+        if(!is_tok(tok_excl)) return false;
+        ++i; eat_whitespace();
+        if(!is_identifier(atom_defined)) return false;
+        ++i; eat_whitespace();
+        if(is_tok(tok_paren_l)) {
+            parenthesized = true;
+            ++i; eat_whitespace();
+        }
+    } else {
+        return false;
+    }
+    if(!is_tok(tok_identifier)) return false;
+    atom_t name = tokens[i].atom;
+    ++i; eat_whitespace();
+    if(parenthesized) {
+        if(!is_tok(tok_paren_r)) return false;
+        ++i; eat_whitespace();
+    }
+    if(!is_tok(tok_newline)) return false;
+
+    // Its #endif must close the file, with no #else or #elif on the way
+    int depth = 1;
+    bool line_start = true;
+    while(i < tokens.size() && !is_tok(tok_eof)) {
+        if(is_tok(tok_newline)) {
+            line_start = true;
+            ++i;
+            continue;
+        }
+        if(is_tok(tok_whitespace)) {
+            ++i;
+            continue;
+        }
+        if(!line_start || !is_tok(tok_hash)) {
+            line_start = false;
+            ++i;
+            continue;
+        }
+        line_start = false;
+        ++i; eat_whitespace();
+        if(is_identifier(atom_if) || is_identifier(atom_ifdef) || is_identifier(atom_ifndef)) {
+            ++depth;
+        } else if((is_identifier(atom_else) || is_identifier(atom_elif)) && depth == 1) {
+            return false;
+        } else if(is_identifier(atom_endif)) {
+            --depth;
+            if(depth == 0) {
+                ++i;
+                while(i < tokens.size() && !is_tok(tok_newline) && !is_tok(tok_eof)) ++i;
+                eat_whitespace_and_newline();
+                if(i < tokens.size() && !is_tok(tok_eof)) {
+                    return false;
+                }
+                guard = name;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void build_directive_index(const std::vector<token>& tokens, directive_index& index) {
+    index.conditionals.clear();
+    std::vector<size_t> open; // last directive of each unterminated #if chain
+    bool line_start = true;
+    for(size_t i = 0; i < tokens.size() && tokens[i].type != tok_eof; ++i) {
+        const token& tok = tokens[i];
+        if(tok.type == tok_newline) {
+            line_start = true;
+            continue;
+        }
+        if(tok.type == tok_whitespace) {
+            continue;
+        }
+        if(!line_start || tok.type != tok_hash) {
+            line_start = false;
+            continue;
+        }
+        line_start = false;
+        size_t j = i + 1;
+        while(j < tokens.size() && tokens[j].type == tok_whitespace) ++j;
+        if(j == tokens.size() || tokens[j].type != tok_identifier) {
+            continue;
+        }
+        atom_t name = tokens[j].atom;
+        cond_directive dir;
+        dir.hash_index = (uint32_t)i;
+        if(name == atom_if || name == atom_ifdef || name == atom_ifndef) {
+            open.push_back(index.conditionals.size());
+            index.conditionals.push_back(dir);
+        } else if((name == atom_elif || name == atom_else) && !open.empty()) {
+            index.conditionals[open.back()].next = (uint32_t)i;
+            open.back() = index.conditionals.size();
+            index.conditionals.push_back(dir);
+        } else if(name == atom_endif && !open.empty()) {
+            index.conditionals[open.back()].next = (uint32_t)i;
+            open.pop_back();
+        }
+        i = j;
+    }
+}
+
+static size_t entry_bytes(const cached_file& file) {
+    return file.text.size() + file.tokens.size() * sizeof(token);
+}
+
+file_cache& file_cache::get() {
+    static file_cache cache;
+    return cache;
+}
+
+std::shared_ptr<const cached_file> file_cache::load(const char* path, bool* hit) {
+    if(hit) {
+        *hit = false;
+    }
+    std::string full_path;
+    if(!canonical_path(path, full_path)) {
+        printf("Failed to open file %s\n", path);
+        return 0;
+    }
+    int64_t mtime;
+    uint64_t size;
+    if(!stat_file(full_path.c_str(), mtime, size)) {
+        printf("Failed to open file %s\n", path);
+        return 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = files.find(full_path);
+        if(it != files.end()) {
+            const cached_file& cached = *it->second.file;
+            if(cached.mtime == mtime && cached.size == size) {
+                ++hit_count;
+                it->second.last_use = ++use_count;
+                if(hit) {
+                    *hit = true;
+                }
+                return it->second.file;
+            }
+            // Changed on disk
+            erase(it);
+            ++eviction_count;
+        }
+        ++miss_count;
+    }
+
+    // Load and tokenize outside of the lock,
+    // if two threads miss on the same file at once the last one wins
+    std::shared_ptr<cached_file> entry(new cached_file);
+    entry->path = full_path;
+    entry->mtime = mtime;
+    if(!read_file(full_path.c_str(), entry->text)) {
+        return 0;
+    }
+    // What was read, if the file changed after the stat the next lookup sees it
+    entry->size = entry->text.size() - 1;
+    entry->source.reset(entry->text.data(), entry->text.size() - 1, full_path.c_str());
+    if(entry->source.get() == source_none) {
+        return 0;
+    }
+    if(!tokenize_parallel(entry->source.get(), entry->tokens, false, false, get_tokenize_thread_count())) {
+        return 0;
+    }
+    detect_include_guard(entry->tokens, entry->guard_macro);
+    build_directive_index(entry->tokens, entry->directives);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = files.find(full_path);
+    if(it != files.end()) {
+        erase(it);
+    }
+    slot& s = files[full_path];
+    s.file = entry;
+    s.last_use = ++use_count;
+    total_bytes += entry_bytes(*entry);
+    evict();
+    return entry;
+}
+
+// Caller holds the lock
+void file_cache::erase(std::map<std::string, slot>::iterator it) {
+    total_bytes -= entry_bytes(*it->second.file);
+    files.erase(it);
+}
+
+// Least recently used first, caller holds the lock
+void file_cache::evict() {
+    while(!files.empty() && (files.size() > max_files || total_bytes > max_bytes)) {
+        auto oldest = files.begin();
+        for(auto it = files.begin(); it != files.end(); ++it) {
+            if(it->second.last_use < oldest->second.last_use) {
+                oldest = it;
+            }
+        }
+        erase(oldest);
+        ++eviction_count;
+    }
+}
+
+void file_cache::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    files.clear();
+    total_bytes = 0;
+}
+
+static_assert(file_cache::DEFAULT_MAX_FILES <= SOURCE_ID_COUNT / 2, "cached files take one source id each");
+
+void file_cache::set_limits(size_t max_files, size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(mtx);
+    // Every entry takes a source id, half of them are left for everything else
+    this->max_files = max_files < SOURCE_ID_COUNT / 2 ? max_files : SOURCE_ID_COUNT / 2;
+    this->max_bytes = max_bytes;
+    evict();
+}
+
+uint64_t file_cache::hits() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return hit_count;
+}
+uint64_t file_cache::misses() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return miss_count;
+}
+uint64_t file_cache::evictions() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return eviction_count;
+}
+
+} // cppi
@@ -0,0 +1,113 @@
+#ifndef CPPI_FILE_CACHE_HPP
+#define CPPI_FILE_CACHE_HPP
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "token.hpp"
+#include "source.hpp"
+
+
+namespace cppi {
+
+// Conditional directive, by index of its '#' token
+struct cond_directive {
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    uint32_t hash_index;
+    uint32_t next = NONE; // '#' of the #elif, #else or #endif that ends this group
+};
+
+// #if/#ifdef/#ifndef/#elif/#else of a file, lets a disabled group be skipped in one jump
+struct directive_index {
+    std::vector<cond_directive> conditionals; // in file order
+
+    // cond_directive::NONE if there is no conditional at hash_index or it's unterminated
+    uint32_t find_next(uint32_t hash_index) const {
+        size_t lo = 0;
+        size_t hi = conditionals.size();
+        while(lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if(conditionals[mid].hash_index < hash_index) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if(lo == conditionals.size() || conditionals[lo].hash_index != hash_index) {
+            return cond_directive::NONE;
+        }
+        return conditionals[lo].next;
+    }
+};
+
+// Copy of a file and its preprocessing tokens
+// Immutable once it's in the cache, so any number of threads can read it
+// The text is owned, not mapped, so the file can be rewritten or truncated on disk while tokens still point into it
+struct cached_file {
+    std::string         path; // canonical
+    int64_t             mtime = 0;
+    uint64_t            size = 0;
+    std::vector<char>   text; // file and a terminating '\0'
+    scoped_source       source; // text, registered for as long as the entry lives
+    std::vector<token>  tokens;
+    // Macro the whole file is wrapped in (#ifndef X ... #endif), atom_none if none
+    atom_t              guard_macro = atom_none;
+    directive_index     directives;
+};
+
+// Process-wide cache shared by all pp_context instances,
+// keyed by canonical path and validated by mtime and size on every lookup
+// An entry that no longer matches its file is dropped, and the least recently used ones go
+// once there are more than max_files of them or their text and tokens take more than max_bytes
+// A dropped entry lives on for as long as a pp_context still holds it, then its source id is released
+class file_cache {
+    struct slot {
+        std::shared_ptr<const cached_file> file;
+        uint64_t last_use = 0;
+    };
+
+    std::mutex mtx;
+    std::map<std::string, slot> files;
+    size_t total_bytes = 0;
+    size_t max_files = DEFAULT_MAX_FILES;
+    size_t max_bytes = DEFAULT_MAX_BYTES;
+    uint64_t use_count = 0;
+    uint64_t hit_count = 0;
+    uint64_t miss_count = 0;
+    uint64_t eviction_count = 0;
+
+    file_cache() {}
+    void erase(std::map<std::string, slot>::iterator it);
+    void evict();
+public:
+    static const size_t DEFAULT_MAX_FILES = 4096;
+    static const size_t DEFAULT_MAX_BYTES = 256 * 1024 * 1024;
+
+    static file_cache& get();
+
+    // Returns null if the file can't be opened
+    // hit is set to true if the file was already loaded and tokenized
+    std::shared_ptr<const cached_file> load(const char* path, bool* hit = 0);
+    void clear();
+    // Evicts right away if the cache is over the new limits
+    // max_files is capped at SOURCE_ID_COUNT / 2, each entry takes a source id
+    void set_limits(size_t max_files, size_t max_bytes);
+
+    uint64_t hits();
+    uint64_t misses();
+    uint64_t evictions();
+};
+
+bool canonical_path(const char* path, std::string& out);
+bool detect_include_guard(const std::vector<token>& tokens, atom_t& guard);
+void build_directive_index(const std::vector<token>& tokens, directive_index& index);
+
+} // cppi
+
+
+#endif
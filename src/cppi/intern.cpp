@@ -0,0 +1,270 @@
+#include "intern.hpp"
+
+#include <assert.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+
+namespace cppi {
+
+static const char* predefined_atom_strings[] = {
+    "",
+    "include",
+    "define",
+    "undef",
+    "line",
+    "error",
+    "pragma",
+    "if",
+    "ifdef",
+    "ifndef",
+    "elif",
+    "else",
+    "endif",
+    "defined",
+    "once",
+    "__VA_ARGS__",
+    "true",
+    "false"
+};
+static_assert(
+    sizeof(predefined_atom_strings) / sizeof(predefined_atom_strings[0]) == atom_predefined_count,
+    "predefined_atom_strings must match predefined_atom"
+);
+
+static uint32_t hash_string(const char* str, size_t len) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= (uint8_t)str[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+class string_interner {
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    struct entry {
+        const char* str;
+        uint32_t    length;
+        uint32_t    hash;
+    };
+
+    // Lookups of names that are already interned, by far the common case, only take it shared
+    std::shared_timed_mutex mtx;
+    // Strings are never moved once stored, so atom_string() pointers stay valid
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t chunk_used = CHUNK_SIZE;
+    std::vector<entry> entries; // indexed by atom
+    std::vector<atom_t> slots;  // open addressing, atom_none is empty
+
+    const char* store(const char* str, size_t len) {
+        if(chunk_used + len + 1 > CHUNK_SIZE) {
+            size_t size = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+            chunks.push_back(std::unique_ptr<char[]>(new char[size]));
+            chunk_used = 0;
+        }
+        char* dst = chunks.back().get() + chunk_used;
+        memcpy(dst, str, len);
+        dst[len] = '\0';
+        chunk_used += len + 1;
+        return dst;
+    }
+    void grow() {
+        std::vector<atom_t> new_slots(slots.size() * 2, atom_none);
+        size_t mask = new_slots.size() - 1;
+        for(atom_t a = 1; a < entries.size(); ++a) {
+            size_t i = entries[a].hash & mask;
+            while(new_slots[i] != atom_none) {
+                i = (i + 1) & mask;
+            }
+            new_slots[i] = a;
+        }
+        slots.swap(new_slots);
+    }
+    // Slot holding str, or the empty slot where it would go
+    size_t probe(const char* str, size_t len, uint32_t h) const {
+        size_t mask = slots.size() - 1;
+        size_t i = h & mask;
+        while(slots[i] != atom_none) {
+            const entry& e = entries[slots[i]];
+            if(e.hash == h && e.length == len && memcmp(e.str, str, len) == 0) {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+public:
+    string_interner() {
+        slots.resize(4096, atom_none);
+        entries.push_back(entry{ "", 0, 0 });
+        for(atom_t a = 1; a < atom_predefined_count; ++a) {
+            const char* str = predefined_atom_strings[a];
+            atom_t r = intern(str, strlen(str));
+            assert(r == a);
+            (void)r;
+        }
+    }
+
+    atom_t intern(const char* str, size_t len) {
+        uint32_t h = hash_string(str, len);
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(mtx);
+            atom_t atom = slots[probe(str, len, h)];
+            if(atom != atom_none) {
+                return atom;
+            }
+        }
+        std::lock_guard<std::shared_timed_mutex> lock(mtx);
+        // May have been added since the shared lock was released
+        size_t i = probe(str, len, h);
+        if(slots[i] != atom_none) {
+            return slots[i];
+        }
+        atom_t atom = (atom_t)entries.size();
+        entries.push_back(entry{ store(str, len), (uint32_t)len, h });
+        slots[i] = atom;
+        if(entries.size() * 2 > slots.size()) {
+            grow();
+        }
+        return atom;
+    }
+    // Entries with str, length and hash, out gets their atoms
+    // Names that are already interned take one shared lock for all of them, the rest one exclusive lock
+    template<typename E>
+    void intern_all(const E* in, size_t count, atom_t* out) {
+        bool missing = false;
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(mtx);
+            for(size_t i = 0; i < count; ++i) {
+                out[i] = slots[probe(in[i].str, in[i].length, in[i].hash)];
+                missing |= out[i] == atom_none;
+            }
+        }
+        if(!missing) {
+            return;
+        }
+        std::lock_guard<std::shared_timed_mutex> lock(mtx);
+        for(size_t i = 0; i < count; ++i) {
+            if(out[i] != atom_none) {
+                continue;
+            }
+            // Another thread may have added it since the shared lock was released
+            size_t slot = probe(in[i].str, in[i].length, in[i].hash);
+            if(slots[slot] != atom_none) {
+                out[i] = slots[slot];
+                continue;
+            }
+            out[i] = (atom_t)entries.size();
+            entries.push_back(entry{ store(in[i].str, in[i].length), in[i].length, in[i].hash });
+            slots[slot] = out[i];
+            if(entries.size() * 2 > slots.size()) {
+                grow();
+            }
+        }
+    }
+    atom_t find(const char* str, size_t len) {
+        uint32_t h = hash_string(str, len);
+        std::shared_lock<std::shared_timed_mutex> lock(mtx);
+        return slots[probe(str, len, h)];
+    }
+    const char* string(atom_t atom) {
+        std::shared_lock<std::shared_timed_mutex> lock(mtx);
+        assert(atom < entries.size());
+        return entries[atom].str;
+    }
+    size_t length(atom_t atom) {
+        std::shared_lock<std::shared_timed_mutex> lock(mtx);
+        assert(atom < entries.size());
+        return entries[atom].length;
+    }
+};
+
+static string_interner& get_interner() {
+    static string_interner interner;
+    return interner;
+}
+
+atom_t intern(const char* str, size_t len) {
+    return get_interner().intern(str, len);
+}
+atom_t intern(const std::string& str) {
+    return get_interner().intern(str.data(), str.size());
+}
+atom_t find_atom(const char* str, size_t len) {
+    return get_interner().find(str, len);
+}
+const char* atom_string(atom_t atom) {
+    return get_interner().string(atom);
+}
+size_t atom_length(atom_t atom) {
+    return get_interner().length(atom);
+}
+
+local_interner::local_interner() {
+    slots.resize(1024, atom_none);
+    entries.push_back(entry{ "", 0, 0 });
+}
+
+void local_interner::grow() {
+    std::vector<atom_t> new_slots(slots.size() * 2, atom_none);
+    size_t mask = new_slots.size() - 1;
+    for(atom_t a = 1; a < entries.size(); ++a) {
+        size_t i = entries[a].hash & mask;
+        while(new_slots[i] != atom_none) {
+            i = (i + 1) & mask;
+        }
+        new_slots[i] = a;
+    }
+    slots.swap(new_slots);
+}
+
+atom_t local_interner::intern(const char* str, size_t len) {
+    uint32_t h = hash_string(str, len);
+    size_t mask = slots.size() - 1;
+    size_t i = h & mask;
+    while(slots[i] != atom_none) {
+        const entry& e = entries[slots[i]];
+        if(e.hash == h && e.length == len && memcmp(e.str, str, len) == 0) {
+            return slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    // Copied, str may be a temporary with the line splices taken out
+    if(chunk_used + len + 1 > CHUNK_SIZE) {
+        size_t size = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+        chunks.push_back(std::unique_ptr<char[]>(new char[size]));
+        chunk_used = 0;
+    }
+    char* dst = chunks.back().get() + chunk_used;
+    memcpy(dst, str, len);
+    dst[len] = '\0';
+    chunk_used += len + 1;
+
+    atom_t atom = (atom_t)entries.size();
+    entries.push_back(entry{ dst, (uint32_t)len, h });
+    slots[i] = atom;
+    if(entries.size() * 2 > slots.size()) {
+        grow();
+    }
+    return atom;
+}
+
+void local_interner::merge(std::vector<atom_t>& map) {
+    if(map.empty()) {
+        map.push_back(atom_none);
+    }
+    size_t first = map.size();
+    if(first >= entries.size()) {
+        return;
+    }
+    map.resize(entries.size());
+    get_interner().intern_all(entries.data() + first, entries.size() - first, map.data() + first);
+}
+
+} // cppi
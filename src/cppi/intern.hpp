@@ -0,0 +1,79 @@
+#ifndef CPPI_INTERN_HPP
+#define CPPI_INTERN_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+
+namespace cppi {
+
+// Dense id of an interned identifier, equal strings always get the same atom
+typedef uint32_t atom_t;
+
+// Interned up front in this order, so they can be compared against directly
+enum predefined_atom : atom_t {
+    atom_none = 0,
+    atom_include,
+    atom_define,
+    atom_undef,
+    atom_line,
+    atom_error,
+    atom_pragma,
+    atom_if,
+    atom_ifdef,
+    atom_ifndef,
+    atom_elif,
+    atom_else,
+    atom_endif,
+    atom_defined,
+    atom_once,
+    atom_va_args,
+    atom_true,
+    atom_false,
+
+    atom_predefined_count
+};
+
+// Process-wide, since cached files carry atoms and are shared between contexts
+atom_t      intern(const char* str, size_t len);
+atom_t      intern(const std::string& str);
+// Returns atom_none if str was never interned, never adds it
+atom_t      find_atom(const char* str, size_t len);
+// Null terminated, stays valid for the lifetime of the process
+const char* atom_string(atom_t atom);
+size_t      atom_length(atom_t atom);
+
+// Interning table of one thread, no locks, so threads lexing at once don't contend for the process-wide one
+// Local atoms count up from 1, atom_none stays 0, merge() turns them into process-wide atoms
+class local_interner {
+    struct entry {
+        const char* str;
+        uint32_t    length;
+        uint32_t    hash;
+    };
+
+    static const size_t CHUNK_SIZE = 16 * 1024;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t chunk_used = CHUNK_SIZE;
+    std::vector<entry> entries; // by local atom, [0] unused
+    std::vector<atom_t> slots;  // open addressing, atom_none is empty
+
+    void grow();
+public:
+    local_interner();
+    local_interner(const local_interner&) = delete;
+    local_interner& operator=(const local_interner&) = delete;
+
+    atom_t intern(const char* str, size_t len);
+    // Interns the strings added since the last merge into the process-wide table, under one lock,
+    // map[local atom] is the process-wide atom
+    void merge(std::vector<atom_t>& map);
+};
+
+} // cppi
+
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef CPPI_KEYWORDS_HPP
+#define CPPI_KEYWORDS_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include "token.hpp"
+
+
+struct keyword_entry {
+    const char* name;
+    token_type  type;
+};
+
+// Every keyword token_type, recognized at tokenize time
+constexpr keyword_entry keyword_entries[] = {
+    { "alignas",          tok_alignas },
+    { "alignof",          tok_alignof },
+    { "and",              tok_and },
+    { "and_eq",           tok_and_eq },
+    { "asm",              tok_asm },
+    { "atomic_cancel",    tok_atomic_cancel },
+    { "atomic_commit",    tok_atomic_commit },
+    { "atomic_noexcept",  tok_atomic_noexcept },
+    { "bitand",           tok_bitand },
+    { "bitor",            tok_bitor },
+    { "break",            tok_break },
+    { "case",             tok_case },
+    { "catch",            tok_catch },
+    { "class",            tok_class },
+    { "compl",            tok_compl },
+    { "concept",          tok_concept },
+    { "const",            tok_const },
+    { "consteval",        tok_consteval },
+    { "constexpr",        tok_constexpr },
+    { "constinit",        tok_constinit },
+    { "const_cast",       tok_const_cast },
+    { "continue",         tok_continue },
+    { "co_await",         tok_co_await },
+    { "co_return",        tok_co_return },
+    { "co_yield",         tok_co_yield },
+    { "decltype",         tok_decltype },
+    { "default",          tok_default },
+    { "delete",           tok_delete },
+    { "do",               tok_do },
+    { "dynamic_cast",     tok_dynamic_cast },
+    { "else",             tok_else },
+    { "enum",             tok_enum },
+    { "explicit",         tok_explicit },
+    { "export",           tok_export },
+    { "extern",           tok_extern },
+    { "false",            tok_false },
+    { "for",              tok_for },
+    { "friend",           tok_friend },
+    { "goto",             tok_goto },
+    { "if",               tok_if },
+    { "inline",           tok_inline },
+    { "mutable",          tok_mutable },
+    { "namespace",        tok_namespace },
+    { "new",              tok_new },
+    { "noexcept",         tok_noexcept },
+    { "not",              tok_not },
+    { "not_eq",           tok_not_eq },
+    { "nullptr",          tok_nullptr },
+    { "operator",         tok_operator },
+    { "or",               tok_or },
+    { "or_eq",            tok_or_eq },
+    { "private",          tok_private },
+    { "protected",        tok_protected },
+    { "public",           tok_public },
+    { "reflexpr",         tok_reflexpr },
+    { "register",         tok_register },
+    { "reinterpret_cast", tok_reinterpret_cast },
+    { "requires",         tok_requires },
+    { "return",           tok_return },
+    { "sizeof",           tok_sizeof },
+    { "static",           tok_static },
+    { "static_assert",    tok_static_assert },
+    { "static_cast",      tok_static_cast },
+    { "struct",           tok_struct },
+    { "switch",           tok_switch },
+    { "template",         tok_template },
+    { "this",             tok_this },
+    { "thread_local",     tok_thread_local },
+    { "throw",            tok_throw },
+    { "true",             tok_true },
+    { "try",              tok_try },
+    { "typedef",          tok_typedef },
+    { "typeid",           tok_typeid },
+    { "typename",         tok_typename },
+    { "union",            tok_union },
+    { "using",            tok_using },
+    { "virtual",          tok_virtual },
+    { "volatile",         tok_volatile },
+    { "while",            tok_while },
+    { "xor",              tok_xor },
+    { "xor_eq",           tok_xor_eq },
+    { "char",             tok_char },
+    { "char16_t",         tok_char16_t },
+    { "char32_t",         tok_char32_t },
+    { "wchar_t",          tok_wchar_t },
+    { "bool",             tok_bool },
+    { "short",            tok_short },
+    { "int",              tok_int },
+    { "long",             tok_long },
+    { "signed",           tok_signed },
+    { "unsigned",         tok_unsigned },
+    { "float",            tok_float },
+    { "double",           tok_double },
+    { "void",             tok_void },
+    { "auto",             tok_auto },
+    { "final",            tok_final },
+    { "override",         tok_override },
+};
+constexpr size_t KEYWORD_COUNT = sizeof(keyword_entries) / sizeof(keyword_entries[0]);
+constexpr size_t KEYWORD_MIN_LENGTH = 2;
+constexpr size_t KEYWORD_MAX_LENGTH = 16;
+
+constexpr size_t keyword_strlen(const char* str) {
+    size_t len = 0;
+    while(str[len]) ++len;
+    return len;
+}
+
+// Seed was picked offline so that no two keywords land in the same slot,
+// make_keyword_hash_table() below checks it at compile time
+constexpr uint32_t KEYWORD_HASH_SEED = 8201;
+constexpr uint32_t KEYWORD_HASH_BITS = 9;
+constexpr size_t KEYWORD_HASH_TABLE_SIZE = size_t(1) << KEYWORD_HASH_BITS;
+
+// Only valid for len >= KEYWORD_MIN_LENGTH
+constexpr uint32_t keyword_hash(const char* str, size_t len) {
+    uint32_t k = (uint32_t)(uint8_t)str[0]
+        | ((uint32_t)(uint8_t)str[1] << 8)
+        | ((uint32_t)(uint8_t)str[len - 1] << 16)
+        | ((uint32_t)len << 24);
+    uint32_t x = k * KEYWORD_HASH_SEED;
+    x ^= (uint32_t)(uint8_t)str[len >> 1] * 0x9e3779b1u;
+    x *= 0x85ebca6bu;
+    return x >> (32 - KEYWORD_HASH_BITS);
+}
+
+struct keyword_hash_table {
+    uint8_t slots[KEYWORD_HASH_TABLE_SIZE]; // index into keyword_entries, 0xFF if empty
+    uint8_t lengths[KEYWORD_COUNT];
+    bool    perfect;
+};
+
+constexpr keyword_hash_table make_keyword_hash_table() {
+    keyword_hash_table table = {};
+    table.perfect = true;
+    for(size_t i = 0; i < KEYWORD_HASH_TABLE_SIZE; ++i) {
+        table.slots[i] = 0xFF;
+    }
+    for(size_t i = 0; i < KEYWORD_COUNT; ++i) {
+        size_t len = keyword_strlen(keyword_entries[i].name);
+        if(len < KEYWORD_MIN_LENGTH || len > KEYWORD_MAX_LENGTH) {
+            table.perfect = false;
+        }
+        uint32_t h = keyword_hash(keyword_entries[i].name, len);
+        if(table.slots[h] != 0xFF) {
+            table.perfect = false;
+        }
+        table.slots[h] = (uint8_t)i;
+        table.lengths[i] = (uint8_t)len;
+    }
+    return table;
+}
+
+constexpr keyword_hash_table keyword_table = make_keyword_hash_table();
+static_assert(KEYWORD_COUNT < 0xFF, "keyword index must fit in a slot");
+static_assert(keyword_table.perfect, "keyword hash has collisions, pick another KEYWORD_HASH_SEED");
+
+// Returns the keyword token type, or tok_identifier if str is not a keyword
+inline token_type keyword_lookup(const char* str, size_t len) {
+    if(len < KEYWORD_MIN_LENGTH || len > KEYWORD_MAX_LENGTH) {
+        return tok_identifier;
+    }
+    uint8_t idx = keyword_table.slots[keyword_hash(str, len)];
+    if(idx == 0xFF || keyword_table.lengths[idx] != len) {
+        return tok_identifier;
+    }
+    if(memcmp(keyword_entries[idx].name, str, len) != 0) {
+        return tok_identifier;
+    }
+    return keyword_entries[idx].type;
+}
+
+#endif
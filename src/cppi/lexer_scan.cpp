@@ -0,0 +1,198 @@
+#include "lexer_scan.hpp"
+
+#include <stdint.h>
+#include <atomic>
+
+#include "simd.hpp"
+#include "char_class.hpp"
+
+
+namespace cppi {
+
+// Each kind of run has a scalar test and SSE2/AVX2 versions giving a bit per byte that ends the run
+// '\0' ends every run, the lexer stops there
+
+struct identifier_run {
+    static bool stops(char c) { return !is_ident_char(c); }
+#ifdef CPPI_SSE2
+    static uint32_t stops(__m128i v) {
+        // Setting 0x20 folds upper case letters into lower case and nothing else into a-z
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+        return ~(uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under)) & 0xFFFF;
+    }
+    CPPI_TARGET_AVX2 static uint32_t stops(__m256i v) {
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        __m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+        return ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), under));
+    }
+#endif
+};
+
+struct digit_run {
+    static bool stops(char c) { return !is_digit_char(c); }
+#ifdef CPPI_SSE2
+    static uint32_t stops(__m128i v) {
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        return ~(uint32_t)_mm_movemask_epi8(digit) & 0xFFFF;
+    }
+    CPPI_TARGET_AVX2 static uint32_t stops(__m256i v) {
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        return ~(uint32_t)_mm256_movemask_epi8(digit);
+    }
+#endif
+};
+
+struct whitespace_run {
+    static bool stops(char c) { return !is_space_char(c); }
+#ifdef CPPI_SSE2
+    static uint32_t stops(__m128i v) {
+        __m128i space = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))
+        );
+        return ~(uint32_t)_mm_movemask_epi8(space) & 0xFFFF;
+    }
+    CPPI_TARGET_AVX2 static uint32_t stops(__m256i v) {
+        __m256i space = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))
+        );
+        return ~(uint32_t)_mm256_movemask_epi8(space);
+    }
+#endif
+};
+
+// Runs ending at any of three characters or '\\' (and '\0')
+template<char A, char B, char C>
+struct until_run {
+    static bool stops(char c) { return c == A || c == B || c == C || c == '\\' || c == '\0'; }
+#ifdef CPPI_SSE2
+    static uint32_t stops(__m128i v) {
+        __m128i r = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(A)), _mm_cmpeq_epi8(v, _mm_set1_epi8(B))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(C)), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')))
+        );
+        r = _mm_or_si128(r, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        return (uint32_t)_mm_movemask_epi8(r);
+    }
+    CPPI_TARGET_AVX2 static uint32_t stops(__m256i v) {
+        __m256i r = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(A)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(B))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(C)), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')))
+        );
+        r = _mm256_or_si256(r, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+        return (uint32_t)_mm256_movemask_epi8(r);
+    }
+#endif
+};
+// Repeated characters just fill the unused slots
+typedef until_run<'\n', '\n', '\n'> line_comment_run;
+typedef until_run<'*', '*', '*'> block_comment_run;
+typedef until_run<'"', '\n', '\n'> string_body_run;
+typedef until_run<'\'', '\n', '\n'> char_body_run;
+
+template<typename RUN>
+static size_t scan_scalar(const char* buffer, size_t i, size_t length) {
+    while(i < length && !RUN::stops(buffer[i])) {
+        ++i;
+    }
+    return i;
+}
+
+#ifdef CPPI_SSE2
+template<typename RUN>
+static size_t scan_sse2(const char* buffer, size_t i, size_t length) {
+    for(; i + 16 <= length; i += 16) {
+        uint32_t mask = RUN::stops(_mm_loadu_si128((const __m128i*)(buffer + i)));
+        if(mask) {
+            return i + lowest_bit_index(mask);
+        }
+    }
+    return scan_scalar<RUN>(buffer, i, length);
+}
+
+template<typename RUN>
+CPPI_TARGET_AVX2 static size_t scan_avx2(const char* buffer, size_t i, size_t length) {
+    for(; i + 32 <= length; i += 32) {
+        uint32_t mask = RUN::stops(_mm256_loadu_si256((const __m256i*)(buffer + i)));
+        if(mask) {
+            return i + lowest_bit_index(mask);
+        }
+    }
+    return scan_scalar<RUN>(buffer, i, length);
+}
+#endif
+
+static const lexer_scanners scalar_scanners = {
+    &scan_scalar<identifier_run>,
+    &scan_scalar<digit_run>,
+    &scan_scalar<whitespace_run>,
+    &scan_scalar<line_comment_run>,
+    &scan_scalar<block_comment_run>,
+    &scan_scalar<string_body_run>,
+    &scan_scalar<char_body_run>
+};
+#ifdef CPPI_SSE2
+static const lexer_scanners sse2_scanners = {
+    &scan_sse2<identifier_run>,
+    &scan_sse2<digit_run>,
+    &scan_sse2<whitespace_run>,
+    &scan_sse2<line_comment_run>,
+    &scan_sse2<block_comment_run>,
+    &scan_sse2<string_body_run>,
+    &scan_sse2<char_body_run>
+};
+static const lexer_scanners avx2_scanners = {
+    &scan_avx2<identifier_run>,
+    &scan_avx2<digit_run>,
+    &scan_avx2<whitespace_run>,
+    &scan_avx2<line_comment_run>,
+    &scan_avx2<block_comment_run>,
+    &scan_avx2<string_body_run>,
+    &scan_avx2<char_body_run>
+};
+#endif
+
+simd_level best_simd_level() {
+#ifdef CPPI_SSE2
+    static const simd_level best = cpu_has_avx2() ? SIMD_AVX2 : SIMD_SSE2;
+    return best;
+#else
+    return SIMD_NONE;
+#endif
+}
+
+// -1 until first use
+static std::atomic<int> lexer_level(-1);
+
+void set_lexer_simd_level(simd_level level) {
+    if(level > best_simd_level()) {
+        level = best_simd_level();
+    }
+    lexer_level = level;
+}
+simd_level get_lexer_simd_level() {
+    int level = lexer_level;
+    if(level < 0) {
+        level = best_simd_level();
+        lexer_level = level;
+    }
+    return (simd_level)level;
+}
+
+const lexer_scanners& get_lexer_scanners() {
+    switch(get_lexer_simd_level()) {
+#ifdef CPPI_SSE2
+    case SIMD_AVX2: return avx2_scanners;
+    case SIMD_SSE2: return sse2_scanners;
+#endif
+    default: return scalar_scanners;
+    }
+}
+
+} // cppi
@@ -0,0 +1,38 @@
+#ifndef CPPI_LEXER_SCAN_HPP
+#define CPPI_LEXER_SCAN_HPP
+
+#include <stddef.h>
+
+
+namespace cppi {
+
+enum simd_level {
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+// Skip the long runs the lexer would otherwise go through one byte at a time
+// Each returns the first index in [i, length) that ends the run, or length
+// A run never goes past '\\', which might start a line splice, or '\0'
+struct lexer_scanners {
+    size_t (*identifier)(const char* buffer, size_t i, size_t length);    // [A-Za-z0-9_]
+    size_t (*digits)(const char* buffer, size_t i, size_t length);        // [0-9]
+    size_t (*whitespace)(const char* buffer, size_t i, size_t length);    // ' ', '\t', '\r'
+    size_t (*line_comment)(const char* buffer, size_t i, size_t length);  // up to '\n'
+    size_t (*block_comment)(const char* buffer, size_t i, size_t length); // up to '*'
+    size_t (*string_body)(const char* buffer, size_t i, size_t length);   // up to '"' or '\n'
+    size_t (*char_body)(const char* buffer, size_t i, size_t length);     // up to '\'' or '\n'
+};
+
+// Highest level the cpu supports
+simd_level best_simd_level();
+// Best level by default, can be lowered, e.g. to check the results against the scalar versions
+void set_lexer_simd_level(simd_level level);
+simd_level get_lexer_simd_level();
+const lexer_scanners& get_lexer_scanners();
+
+} // cppi
+
+
+#endif
@@ -0,0 +1,155 @@
+#include "load_file.hpp"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace cppi {
+
+static const char empty_file_data[1] = { '\0' };
+
+mapped_file::~mapped_file() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const char* fname) {
+    close();
+    HANDLE hfile = CreateFileA(
+        fname, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0
+    );
+    if(hfile == INVALID_HANDLE_VALUE) {
+        printf("Failed to open file %s\n", fname);
+        return false;
+    }
+    LARGE_INTEGER fsize;
+    if(!GetFileSizeEx(hfile, &fsize)) {
+        CloseHandle(hfile);
+        printf("Failed to open file %s\n", fname);
+        return false;
+    }
+    if(fsize.QuadPart == 0) {
+        // Can't map an empty file
+        CloseHandle(hfile);
+        data_ = empty_file_data;
+        size_ = 0;
+        return true;
+    }
+    HANDLE hmapping = CreateFileMappingA(hfile, 0, PAGE_READONLY, 0, 0, 0);
+    if(!hmapping) {
+        CloseHandle(hfile);
+        printf("Failed to map file %s\n", fname);
+        return false;
+    }
+    void* view = MapViewOfFile(hmapping, FILE_MAP_READ, 0, 0, 0);
+    if(!view) {
+        CloseHandle(hmapping);
+        CloseHandle(hfile);
+        printf("Failed to map file %s\n", fname);
+        return false;
+    }
+    file_handle = hfile;
+    mapping_handle = hmapping;
+    data_ = (const char*)view;
+    size_ = (size_t)fsize.QuadPart;
+    return true;
+}
+
+void mapped_file::close() {
+    if(data_ && data_ != empty_file_data) {
+        UnmapViewOfFile(data_);
+    }
+    if(mapping_handle) {
+        CloseHandle(mapping_handle);
+    }
+    if(file_handle) {
+        CloseHandle(file_handle);
+    }
+    data_ = 0;
+    size_ = 0;
+    file_handle = 0;
+    mapping_handle = 0;
+}
+
+#else
+
+bool mapped_file::open(const char* fname) {
+    close();
+    int fdesc = ::open(fname, O_RDONLY);
+    if(fdesc < 0) {
+        printf("Failed to open file %s\n", fname);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fdesc, &st) != 0) {
+        ::close(fdesc);
+        printf("Failed to open file %s\n", fname);
+        return false;
+    }
+    if(st.st_size == 0) {
+        // Can't map an empty file
+        ::close(fdesc);
+        data_ = empty_file_data;
+        size_ = 0;
+        return true;
+    }
+    void* view = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fdesc, 0);
+    if(view == MAP_FAILED) {
+        ::close(fdesc);
+        printf("Failed to map file %s\n", fname);
+        return false;
+    }
+    madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+    fd = fdesc;
+    data_ = (const char*)view;
+    size_ = (size_t)st.st_size;
+    return true;
+}
+
+void mapped_file::close() {
+    if(data_ && data_ != empty_file_data) {
+        munmap((void*)data_, size_);
+    }
+    if(fd >= 0) {
+        ::close(fd);
+    }
+    data_ = 0;
+    size_ = 0;
+    fd = -1;
+}
+
+#endif
+
+bool read_file(const char* fname, std::vector<char>& buffer) {
+    buffer.clear();
+    FILE* f = fopen(fname, "rb");
+    if(!f) {
+        printf("Failed to open file %s\n", fname);
+        return false;
+    }
+    char chunk[64 * 1024];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f)) != 0) {
+        buffer.insert(buffer.end(), chunk, chunk + n);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    if(!ok) {
+        printf("Failed to read file %s\n", fname);
+        buffer.clear();
+        return false;
+    }
+    buffer.push_back('\0');
+    return true;
+}
+
+} // cppi
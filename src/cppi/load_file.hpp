@@ -1,11 +1,43 @@
 #ifndef CPPI_LOAD_FILE_HPP
 #define CPPI_LOAD_FILE_HPP
 
-#include <fstream>
+#include <stddef.h>
 #include <vector>
 
 
+namespace cppi {
 
+// Read-only view of a whole file, memory-mapped where possible.
+// Line splices (backslash-newline) are left in place,
+// the tokenizer skips them lazily
+class mapped_file {
+    const char* data_ = 0;
+    size_t      size_ = 0;
+#ifdef _WIN32
+    void*       file_handle = 0;
+    void*       mapping_handle = 0;
+#else
+    int         fd = -1;
+#endif
+public:
+    mapped_file() {}
+    ~mapped_file();
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    bool open(const char* fname);
+    void close();
+
+    bool is_open() const { return data_ != 0; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+// Copy of the whole file, for text that is kept while the file may change on disk
+// buffer holds the file followed by a '\0' that is not part of it, so it's never empty
+bool read_file(const char* fname, std::vector<char>& buffer);
+
+} // cppi
 
 
 #endif
@@ -1,119 +1,422 @@
 #ifndef CPPI_PARSE_NODE_HPP
 #define CPPI_PARSE_NODE_HPP
 
+#include <stdint.h>
 #include <vector>
 #include <memory>
 #include "token.hpp"
+#include "pp_output.hpp"
 
 
 namespace cppi {
 
-enum node_type {
+enum node_type : uint8_t {
     node_token,
     node_token_seq,
     node_brace_block,
     node_bracket_block,
     node_paren_block
 };
+
+typedef uint32_t node_id;
+const node_id node_none = UINT32_MAX;
+
 struct node {
-    node(node_type type, node* parent)
-    : type(type), parent(parent) {
-        tok = 0;
-    }
     node_type type;
-    node* parent;
-    std::vector<std::unique_ptr<node>> nodes;
-    token* tok;
+    node_id parent = node_none;
+    uint32_t first_child = 0; // into parse_tree::children, a block's children are one contiguous range
+    uint32_t child_count = 0;
+    const token* tok = 0; // node_token only
+
+    uint32_t token_first = 0;
+    uint32_t token_count = 0;
+};
+
+// Nesting of {}, [] and (), nodes and child lists are flat arrays indexed by 32-bit ids
+// Built in one pass over the tokens: the children of an open block are collected on a stack
+// and moved into one contiguous range once it closes
+// Nothing is freed per node, the whole tree goes away with its arrays
+class parse_tree {
+    std::vector<node> nodes; // node 0 is the root
+    std::vector<node_id> children;
+    std::vector<node_id> pending; // children of the blocks still open
+    std::vector<uint32_t> pending_first; // where each open block's children start in pending
+    node_id current = node_none;
+
+    node_id add_node(node_type type) {
+        node n;
+        n.type = type;
+        n.parent = current;
+        nodes.push_back(n);
+        node_id id = (node_id)(nodes.size() - 1);
+        pending.push_back(id);
+        return id;
+    }
+    void finish_children(node& n) {
+        uint32_t first = pending_first.back();
+        pending_first.pop_back();
+        n.first_child = (uint32_t)children.size();
+        n.child_count = (uint32_t)(pending.size() - first);
+        children.insert(children.end(), pending.begin() + first, pending.end());
+        pending.resize(first);
+    }
+public:
+    void begin() {
+        nodes.clear();
+        children.clear();
+        pending.clear();
+        pending_first.clear();
+        node root;
+        root.type = node_token_seq;
+        nodes.push_back(root);
+        current = 0;
+        pending_first.push_back(0);
+    }
+    void add_token(const token* tok, uint32_t tid) {
+        node& n = nodes[add_node(node_token)];
+        n.tok = tok;
+        n.token_first = tid;
+        n.token_count = 1;
+    }
+    void open_block(node_type type) {
+        current = add_node(type);
+        pending_first.push_back((uint32_t)pending.size());
+    }
+    // Token range is from the opening bracket at open_tid to the closing one at tid
+    void close_block(uint32_t open_tid, uint32_t tid) {
+        node& n = nodes[current];
+        n.token_first = open_tid;
+        n.token_count = tid - open_tid + 1;
+        finish_children(n);
+        current = n.parent;
+    }
+    // Blocks left open keep the children they got so far
+    // token_count of the root, the tokens may still be coming in while the tree is built
+    void end(uint32_t token_count) {
+        nodes[0].token_count = token_count;
+        while(current != node_none) {
+            node& n = nodes[current];
+            finish_children(n);
+            current = n.parent;
+        }
+    }
 
-    int token_first = 0;
-    int token_count = 0;
+    const node* root() const { return &nodes[0]; }
+    const node* get(node_id id) const { return &nodes[id]; }
+    const node* child(const node* n, size_t i) const {
+        return &nodes[children[n->first_child + i]];
+    }
+    size_t node_count() const { return nodes.size(); }
 };
 
 
+// Rules whose results are kept in a parse_memo
+enum parse_rule : uint8_t {
+    RULE_ATTRIBUTE_SPECIFIER_SEQ,
+    RULE_BASE_SPECIFIER,
+    RULE_DECL_SPECIFIER_SEQ,
+    RULE_DECLARATOR,
+    RULE_CLASS_HEAD,
+    RULE_COUNT
+};
+
+// Packrat memo, what a rule produced at a position so trying it there again is one lookup
+// Keyed by rule and by the item a cursor is on, which stands for (sequence, position):
+// its node id over a tree, its token index over the bracket index
+// Results depend on nothing but the tokens
+class parse_memo {
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct store_base {
+        virtual ~store_base() {}
+    };
+    template<typename T>
+    struct store : store_base {
+        std::vector<T> results;
+    };
+    struct entry {
+        int adv;
+        uint32_t result;
+    };
+    std::vector<uint32_t> slots[RULE_COUNT]; // by key, into entries, NONE if the rule never ran there
+    std::vector<entry> entries[RULE_COUNT];
+    std::unique_ptr<store_base> stores[RULE_COUNT]; // results of each rule, of the rule's type
+    size_t key_count = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+
+    template<typename T>
+    std::vector<T>& results(parse_rule rule) {
+        if(!stores[rule]) {
+            stores[rule].reset(new store<T>());
+        }
+        return static_cast<store<T>*>(stores[rule].get())->results;
+    }
+public:
+    // Keys are below key_count, tables are filled in as rules first run
+    void reset(size_t count) {
+        key_count = count;
+        for(int i = 0; i < RULE_COUNT; ++i) {
+            slots[i].clear();
+            entries[i].clear();
+            stores[i].reset();
+        }
+        hits = 0;
+        misses = 0;
+    }
+    template<typename T>
+    const T* find(parse_rule rule, uint32_t key, int& adv) {
+        if(slots[rule].empty() || slots[rule][key] == NONE) {
+            return 0;
+        }
+        ++hits;
+        const entry& e = entries[rule][slots[rule][key]];
+        adv = e.adv;
+        return &results<T>(rule)[e.result];
+    }
+    template<typename T>
+    void add(parse_rule rule, uint32_t key, int adv, const T& result) {
+        ++misses;
+        if(slots[rule].empty()) {
+            slots[rule].resize(key_count, (uint32_t)NONE);
+        }
+        std::vector<T>& r = results<T>(rule);
+        entry e;
+        e.adv = adv;
+        e.result = (uint32_t)r.size();
+        r.push_back(result);
+        slots[rule][key] = (uint32_t)entries[rule].size();
+        entries[rule].push_back(e);
+    }
+
+    // Rule runs answered from the memo, each one a re-scan avoided
+    size_t hit_count() const { return hits; }
+    size_t miss_count() const { return misses; }
+};
+
+// Set of item kinds, one bit per token_type
+// An item's kind is its token type, a bracket group's is its opening bracket and past the end it is tok_eof
+struct first_set {
+    uint64_t bits[4];
+
+    constexpr bool has(token_type type) const {
+        return ((bits[type >> 6] >> (type & 63)) & 1) != 0;
+    }
+};
+static_assert(tok_eof < 256, "token types must fit in a first_set");
+
+constexpr first_set operator|(const first_set& a, const first_set& b) {
+    return first_set{ { a.bits[0] | b.bits[0], a.bits[1] | b.bits[1], a.bits[2] | b.bits[2], a.bits[3] | b.bits[3] } };
+}
+template<typename... T>
+constexpr first_set make_first_set(T... types) {
+    first_set set = { { 0, 0, 0, 0 } };
+    const token_type list[] = { types... };
+    for(size_t i = 0; i < sizeof...(T); ++i) {
+        set.bits[list[i] >> 6] |= 1ull << (list[i] & 63);
+    }
+    return set;
+}
+
+// FIRST sets, the kinds of item a rule can start with when it succeeds
+// A rule entered on anything else fails on its first item, so it's not entered at all
+// Must be kept a superset of what the rule bodies below accept
+constexpr first_set first_nested_name_specifier = make_first_set(tok_double_colon, tok_identifier, tok_decltype);
+constexpr first_set first_attribute_specifier_seq = make_first_set(tok_bracket_l, tok_alignas);
+constexpr first_set first_access_specifier = make_first_set(tok_private, tok_protected, tok_public);
+constexpr first_set first_base_specifier = first_attribute_specifier_seq | first_access_specifier
+    | first_nested_name_specifier | make_first_set(tok_virtual);
+constexpr first_set first_class_head = make_first_set(tok_class, tok_struct, tok_union);
+constexpr first_set first_storage_class_specifier = make_first_set(
+    tok_register, tok_static, tok_thread_local, tok_extern, tok_mutable
+);
+constexpr first_set first_simple_type_specifier = first_nested_name_specifier | make_first_set(
+    tok_char, tok_char16_t, tok_char32_t, tok_wchar_t, tok_bool, tok_short, tok_int, tok_long,
+    tok_signed, tok_unsigned, tok_float, tok_double, tok_void, tok_auto
+);
+constexpr first_set first_cv_qualifier = make_first_set(tok_const, tok_volatile);
+constexpr first_set first_type_specifier = first_simple_type_specifier | first_cv_qualifier | first_class_head;
+constexpr first_set first_function_specifier = make_first_set(tok_inline, tok_virtual, tok_explicit);
+constexpr first_set first_decl_specifier_seq = first_storage_class_specifier | first_type_specifier
+    | first_function_specifier | make_first_set(tok_friend, tok_typedef, tok_constexpr);
+constexpr first_set first_ptr_operator = first_nested_name_specifier | make_first_set(tok_asterisk, tok_amp, tok_double_amp);
+constexpr first_set first_declarator_id = first_nested_name_specifier | make_first_set(tok_elipsis, tok_tilde);
+constexpr first_set first_noptr_declarator = first_declarator_id | make_first_set(tok_paren_l, tok_bracket_l);
+constexpr first_set first_declarator = first_noptr_declarator | first_ptr_operator;
+constexpr first_set first_abstract_declarator = first_ptr_operator | make_first_set(tok_paren_l, tok_bracket_l, tok_elipsis);
+constexpr first_set first_parameter_declaration = first_attribute_specifier_seq | first_decl_specifier_seq;
+constexpr first_set first_initializer = make_first_set(tok_assign, tok_brace_l, tok_paren_l);
+constexpr first_set first_class_specifier = first_class_head;
+constexpr first_set first_simple_declaration = first_attribute_specifier_seq | first_decl_specifier_seq
+    | first_declarator | make_first_set(tok_semicolon);
+constexpr first_set first_function_definition = first_attribute_specifier_seq | first_decl_specifier_seq
+    | first_declarator;
+
+// Walks the items of one sequence, a bracket group counts as a single item
+// Works either over a parse_tree, or directly over the tokens using their bracket_index,
+// where a group is skipped by jumping to its matching closer and no tree is built at all
 struct node_cursor {
-    node* sequence;
+    // Tree
+    const parse_tree* tree = 0;
+    const node* sequence = 0;
+    const node* n = 0;
+    // Tokens and bracket index, the sequence is the tokens [begin, end)
+    const pp_output* tokens = 0;
+    const bracket_index* brackets = 0;
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    uint32_t pos = 0;
+    uint32_t past_end = 0; // advances beyond the end, undone first by prev()
+
     size_t idx = 0;
-    node* n = 0;
+    parse_memo* memo = 0; // optional, passed on to inner()
 
-    node_cursor(node* sequence)
-    : sequence(sequence) {
-        if(!sequence->nodes.empty()) {
-            n = sequence->nodes[idx].get();
+    node_cursor(const parse_tree* tree, const node* sequence)
+    : tree(tree), sequence(sequence) {
+        if(sequence->child_count) {
+            n = tree->child(sequence, idx);
         }
     }
+    node_cursor(const pp_output* tokens, const bracket_index* brackets, uint32_t begin, uint32_t end)
+    : tokens(tokens), brackets(brackets), begin(begin), end(end), pos(begin) {}
+
+    // Tree only
     void go_up() {
-        sequence = sequence->parent;
+        sequence = tree->get(sequence->parent);
         idx = 0;
-        n = sequence->nodes[idx].get();
+        n = tree->child(sequence, idx);
     }
     void next() {
-        ++idx;
-        if(idx >= sequence->nodes.size()) {
-            n = 0;
-        } else {
-            n = sequence->nodes[idx].get();
-        }
+        advance();
     }
     void advance(int i = 1) {
         idx += i;
-        if(idx >= sequence->nodes.size()) {
-            n = 0;
-        } else {
-            n = sequence->nodes[idx].get();
+        if(tree) {
+            if(idx >= sequence->child_count) {
+                n = 0;
+            } else {
+                n = tree->child(sequence, idx);
+            }
+            return;
+        }
+        for(; i > 0; --i) {
+            if(pos >= end) {
+                ++past_end;
+                continue;
+            }
+            uint32_t m = brackets->match_of(pos);
+            // Openers point forward to their closer
+            pos = (m != bracket_index::NONE && m > pos) ? m + 1 : pos + 1;
+            if(pos > end) {
+                pos = end;
+            }
         }
     }
     void prev(int i = 1) {
         idx -= i;
-        if(idx >= sequence->nodes.size()) {
-            n = 0;
-        } else {
-            n = sequence->nodes[idx].get();
+        if(tree) {
+            if(idx >= sequence->child_count) {
+                n = 0;
+            } else {
+                n = tree->child(sequence, idx);
+            }
+            return;
+        }
+        for(; i > 0 && pos > begin; --i) {
+            if(past_end) {
+                --past_end;
+                continue;
+            }
+            // A group left open runs to the limit, there is no closer to jump back from
+            if(pos == brackets->limit()) {
+                uint32_t open = brackets->unclosed_from(begin);
+                if(open != bracket_index::NONE) {
+                    pos = open;
+                    continue;
+                }
+            }
+            uint32_t m = brackets->match_of(pos - 1);
+            // Closers point back to their opener
+            pos = (m != bracket_index::NONE && m < pos - 1) ? m : pos - 1;
         }
     }
     operator bool() const {
-        return n != 0;
+        return tree ? n != 0 : pos < end;
+    }
+    // Type of the current item, which must exist
+    node_type type() const {
+        if(tree) {
+            return n->type;
+        }
+        switch((*tokens)[pos].type) {
+        case tok_brace_l: return node_brace_block;
+        case tok_bracket_l: return node_bracket_block;
+        case tok_paren_l: return node_paren_block;
+        default: return node_token;
+        }
+    }
+    // Token of the current item, which must be a node_token
+    const token* tok() const {
+        return tree ? n->tok : &(*tokens)[pos];
+    }
+    // Items inside the current bracket group
+    node_cursor inner() const {
+        node_cursor c = tree
+            ? node_cursor(tree, n)
+            : node_cursor(tokens, brackets, pos + 1, brackets->match_of(pos));
+        c.memo = memo;
+        return c;
+    }
+    // Item the cursor is on, which must exist
+    // Every item is in exactly one sequence at one position, so this stands for both
+    uint32_t memo_key() const {
+        return tree ? (uint32_t)(n - tree->root()) : pos;
     }
     bool is_token(token_type type) const {
-        if(!n) {
+        if(!*this) {
             if(type == tok_eof) {
                 return true;
             } else {
                 return false;
             }
         }
-        if(n->type == node_token && n->tok->type == type) {
+        if(this->type() == node_token && tok()->type == type) {
             return true;
         }
         return false;
     }
-    bool is_any_of(const std::vector<token_type>& types) const {
-        if(n->type != node_token) {
-            return false;
+    // Kind of the current item, see first_set
+    token_type kind() const {
+        if(!*this) {
+            return tok_eof;
         }
-        for(auto& t : types) {
-            if(n->tok->type == t) {
-                return true;
-            }
+        if(!tree) {
+            return (*tokens)[pos].type;
         }
-        return false;
+        switch(n->type) {
+        case node_token: return n->tok->type;
+        case node_brace_block: return tok_brace_l;
+        case node_bracket_block: return tok_bracket_l;
+        case node_paren_block: return tok_paren_l;
+        default: return tok_error;
+        }
+    }
+    // Single bit test, rules use it to bail out before trying anything
+    bool is_any_of(const first_set& set) const {
+        return set.has(kind());
     }
     bool is_node(node_type type) const {
-        if (!n) return false;
-        return n->type == type;
-    }
-    void print_node(node* nd) const {
-        if(nd->type == node_brace_block) {
-            printf("{ ... } ");
-        } else if(nd->type == node_bracket_block) {
-            printf("[ ... ] ");
-        } else if(nd->type == node_paren_block) {
-            printf("( ... ) ");
-        } else if(nd->type == node_token) {
-            printf("%s ", nd->tok->get_string().c_str());
-        }
+        if (!*this) return false;
+        return this->type() == type;
     }
     void print() const {
-        print_node(n);
+        switch(type()) {
+        case node_brace_block: printf("{ ... } "); break;
+        case node_bracket_block: printf("[ ... ] "); break;
+        case node_paren_block: printf("( ... ) "); break;
+        case node_token: printf("%s ", tok()->get_string().c_str()); break;
+        default: break;
+        }
     }
     void print_some(int count) const {
         node_cursor c = *this;
@@ -130,14 +433,14 @@ struct node_cursor {
 };
 
 
-inline std::string get_identifier_adv(node_cursor& c, int& adv) {
+inline atom_t get_identifier_adv(node_cursor& c, int& adv) {
     if(!c.is_token(tok_identifier)) {
-        return std::string("");
+        return atom_none;
     }
-    std::string str = c.n->tok->get_string();
+    atom_t name = c.tok()->atom;
     adv++;
     c.advance();
-    return str;
+    return name;
 }
 inline int is_tok_adv(node_cursor& c, token_type tok, int& adv) {
     if(c.is_token(tok)) {
@@ -165,6 +468,27 @@ inline int is_node_adv(node_cursor& c, node_type ntype, int& adv) {
     }
 }
 
+// Runs rule at c, or replays what it produced the last time it ran there if c has a memo
+// The result is computed from a fresh T and then merged into out with memo_merge()
+template<typename T>
+inline int memoized(node_cursor c, parse_rule rule, T& out, int (*fn)(node_cursor, T&)) {
+    if(!c.memo || !c) {
+        return fn(c, out);
+    }
+    uint32_t key = c.memo_key();
+    int adv = 0;
+    const T* cached = c.memo->find<T>(rule, key, adv);
+    if(cached) {
+        memo_merge(out, *cached);
+        return adv;
+    }
+    T result = T();
+    adv = fn(c, result);
+    c.memo->add(rule, key, adv, result);
+    memo_merge(out, result);
+    return adv;
+}
+
 enum CLASS_KEY {
     CLASS, STRUCT, UNION
 };
@@ -173,7 +497,7 @@ enum ACCESS_SPECIFIER {
 };
 struct base_specifier {
     ACCESS_SPECIFIER    access;
-    std::string         class_name;
+    atom_t              class_name = atom_none;
 };
 struct base_clause {
     std::vector<base_specifier> specifiers;
@@ -191,18 +515,18 @@ inline int try_class_key(node_cursor c, CLASS_KEY& key) {
     return adv;
 }
 
-inline int try_identifier(node_cursor c, std::string& name) {
+inline int try_identifier(node_cursor c, atom_t& name) {
     if(c.is_token(tok_identifier)) {
-        name = c.n->tok->get_string();
+        name = c.tok()->atom;
         return 1;
     } else {
         return 0;
     }
 }
-inline int try_namespace_name(node_cursor c, std::string& name) {
+inline int try_namespace_name(node_cursor c, atom_t& name) {
     return try_identifier(c, name);
 }
-inline int try_simple_template_id(node_cursor c, std::string& name) {
+inline int try_simple_template_id(node_cursor c, atom_t& name) {
     // TODO
     int adv = 0;
     int r = try_identifier(c, name);
@@ -222,19 +546,19 @@ inline int try_simple_template_id(node_cursor c, std::string& name) {
 
     return 0;
 }
-inline int try_class_name(node_cursor c, std::string& name) {
+inline int try_class_name(node_cursor c, atom_t& name) {
     int r = try_identifier(c, name);
     if(r) return r;
     // TODO: simple-template-id
     return 0;
 }
-inline int try_enum_name(node_cursor c, std::string& name) {
+inline int try_enum_name(node_cursor c, atom_t& name) {
     return try_identifier(c, name);
 }
-inline int try_typedef_name(node_cursor c, std::string& name) {
+inline int try_typedef_name(node_cursor c, atom_t& name) {
     return try_identifier(c, name);
 }
-inline int try_decltype_specifier(node_cursor c, std::string& name) {
+inline int try_decltype_specifier(node_cursor c, atom_t& name) {
     int adv = 0;
     if (!is_tok_adv(c, tok_decltype, adv)) {
         return 0;
@@ -245,7 +569,7 @@ inline int try_decltype_specifier(node_cursor c, std::string& name) {
     return 2;
 }
 
-inline int try_type_name(node_cursor c, std::string& name) {
+inline int try_type_name(node_cursor c, atom_t& name) {
     int r = try_simple_template_id(c, name);
     if(r) return r;
     r = try_class_name(c, name);
@@ -257,12 +581,12 @@ inline int try_type_name(node_cursor c, std::string& name) {
 }
 
 struct nested_name_specifier {
-    std::vector<std::string> names;
+    std::vector<atom_t> names;
 };
 inline int try_nested_name_specifier_tail(node_cursor c, nested_name_specifier& spec = nested_name_specifier());
 inline int try_nested_name_specifier_type_name(node_cursor c, nested_name_specifier& spec = nested_name_specifier()) {
     int adv = 0;
-    std::string name;
+    atom_t name = atom_none;
     int r = try_type_name(c, name);
     c.advance(r); adv +=r;
     if (!r) return 0;
@@ -276,7 +600,7 @@ inline int try_nested_name_specifier_type_name(node_cursor c, nested_name_specif
 }
 inline int try_nested_name_specifier_namespace(node_cursor c, nested_name_specifier& spec = nested_name_specifier()) {
     int adv = 0;
-    std::string name;
+    atom_t name = atom_none;
     int r = try_namespace_name(c, name);
     c.advance(r); adv +=r;
     if (!r) return 0;
@@ -290,7 +614,7 @@ inline int try_nested_name_specifier_namespace(node_cursor c, nested_name_specif
 }
 inline int try_nested_name_specifier_simple_template_id(node_cursor c, nested_name_specifier& spec = nested_name_specifier()) {
     int adv = 0;
-    std::string name;
+    atom_t name = atom_none;
     int r = try_simple_template_id(c, name);
     c.advance(r); adv +=r;
     if (!r) return 0;
@@ -304,7 +628,7 @@ inline int try_nested_name_specifier_simple_template_id(node_cursor c, nested_na
 }
 inline int try_nested_name_specifier_decltype(node_cursor c, nested_name_specifier& spec = nested_name_specifier()) {
     int adv = 0;
-    std::string name;
+    atom_t name = atom_none;
     int r = try_decltype_specifier(c, name);
     c.advance(r); adv +=r;
     if (!r) return 0;
@@ -325,6 +649,7 @@ inline int try_nested_name_specifier_tail(node_cursor c, nested_name_specifier&
     return r;
 }
 inline int try_nested_name_specifier(node_cursor c, nested_name_specifier& spec = nested_name_specifier()) {
+    if(!c.is_any_of(first_nested_name_specifier)) return 0;
     int adv = 0;
     int r = is_tok_adv(c, tok_double_colon, adv);
     bool has_prefix = r != 0;
@@ -350,7 +675,7 @@ inline int try_nested_name_specifier(node_cursor c, nested_name_specifier& spec
     return adv;
 }
 
-inline int try_class_or_decltype_a(node_cursor c, std::string& name) {
+inline int try_class_or_decltype_a(node_cursor c, atom_t& name) {
     int adv = 0;
     nested_name_specifier nested_name;
     int r = try_nested_name_specifier(c, nested_name);
@@ -360,7 +685,7 @@ inline int try_class_or_decltype_a(node_cursor c, std::string& name) {
     if(!r) return 0;
     else return adv;
 }
-inline int try_class_or_decltype(node_cursor c, std::string& name) {
+inline int try_class_or_decltype(node_cursor c, atom_t& name) {
     int r = try_class_or_decltype_a(c, name);
     if(r) return r;
     r = try_decltype_specifier(c, name);
@@ -399,13 +724,18 @@ inline int try_alignment_specifier(node_cursor c) {
     return adv;
 }
 inline int try_bracketed_attribute_specifier(node_cursor c, attribute_specifier& spec) {
-    if(!c.is_node(node_bracket_block) || c.n->nodes.size() != 1) {
+    if(!c.is_node(node_bracket_block)) {
         return 0;
     }
-    if(c.n->nodes[0]->type != node_bracket_block) {
+    // [[ ... ]], the inner group must be the only item
+    node_cursor outer = c.inner();
+    if(!outer.is_node(node_bracket_block)) {
+        return 0;
+    }
+    outer.advance();
+    if(outer) {
         return 0;
     }
-    node_cursor cur(c.n->nodes[0].get());
     
     return 1;
 }
@@ -415,19 +745,27 @@ inline int try_attribute_specifier(node_cursor c, attribute_specifier& spec) {
     r = try_alignment_specifier(c);
     return r;
 }
-inline int try_attribute_specifier_seq(node_cursor c, attribute_specifier_seq& seq = attribute_specifier_seq()) {
+inline int try_attribute_specifier_seq_uncached(node_cursor c, attribute_specifier_seq& seq) {
     int adv = 0;
     attribute_specifier spec;
     int r = try_attribute_specifier(c, spec);
     c.advance(r); adv += r;
     if(!r) return 0;
     seq.specifiers.push_back( spec );
-    r = try_attribute_specifier_seq(c, seq);
+    r = try_attribute_specifier_seq_uncached(c, seq);
     c.advance(r); adv += r;
     return adv;
 }
+// Callers may pass a seq that already has specifiers, the new ones are appended
+inline void memo_merge(attribute_specifier_seq& dst, const attribute_specifier_seq& src) {
+    dst.specifiers.insert(dst.specifiers.end(), src.specifiers.begin(), src.specifiers.end());
+}
+inline int try_attribute_specifier_seq(node_cursor c, attribute_specifier_seq& seq = attribute_specifier_seq()) {
+    if(!c.is_any_of(first_attribute_specifier_seq)) return 0;
+    return memoized(c, RULE_ATTRIBUTE_SPECIFIER_SEQ, seq, &try_attribute_specifier_seq_uncached);
+}
 
-inline int try_base_type_specifier(node_cursor c, std::string& name) {
+inline int try_base_type_specifier(node_cursor c, atom_t& name) {
     return try_class_or_decltype(c, name);
 }
 inline int try_base_specifier_a(node_cursor c, base_specifier& spec){
@@ -478,7 +816,7 @@ inline int try_base_specifier_c(node_cursor c, base_specifier& spec){
     if(!r) return 0;
     return adv;
 }
-inline int try_base_specifier(node_cursor c, base_specifier& spec) {
+inline int try_base_specifier_uncached(node_cursor c, base_specifier& spec) {
     int r = try_base_specifier_a(c, spec);
     if(r) return r;
     r = try_base_specifier_b(c, spec);
@@ -486,6 +824,12 @@ inline int try_base_specifier(node_cursor c, base_specifier& spec) {
     r = try_base_specifier_c(c, spec);
     return r;
 }
+inline void memo_merge(base_specifier& dst, const base_specifier& src) { dst = src; }
+// spec must be fresh, the result replaces it
+inline int try_base_specifier(node_cursor c, base_specifier& spec) {
+    if(!c.is_any_of(first_base_specifier)) return 0;
+    return memoized(c, RULE_BASE_SPECIFIER, spec, &try_base_specifier_uncached);
+}
 inline int try_base_specifier_list(node_cursor c, std::vector<base_specifier>& specifiers);
 inline int try_base_specifier_list_a(node_cursor c, std::vector<base_specifier>& specifiers) {
     int adv = 0;
@@ -539,14 +883,14 @@ inline int try_class_virt_specifier_adv(node_cursor& c, int& adv) {
 }
 
 struct declarator {
-    std::string name;
+    atom_t name = atom_none;
 };
 struct init_declarator {
     declarator decl;
 
     void print() {
-        if(!decl.name.empty()) {
-            printf("%s", decl.name.c_str());
+        if(decl.name != atom_none) {
+            printf("%s", atom_string(decl.name));
         } else {
             printf("{ no-declarator-name }");
         }
@@ -560,7 +904,7 @@ struct init_declarator_list {
             return;
         }
         list[0].print();
-        for(int i = 1; i < list.size(); ++i) {
+        for(size_t i = 1; i < list.size(); ++i) {
             printf(", ");
             list[i].print();
         }
@@ -583,12 +927,12 @@ enum SIGN {
     SIGN_SIGNED
 };
 struct type_specifier {
-    std::string name;
+    atom_t name = atom_none;
     bool is_long = false;
     SIGN sign = SIGN_UNKNOWN;
 
     void print() {
-        printf("%s", name.c_str());
+        printf("%s", atom_string(name));
     }
 };
 struct decl_specifier_seq {
@@ -651,7 +995,8 @@ inline int try_storage_class_specifier(node_cursor c, decl_specifier_seq& seq =
     return 0;
 }
 inline int try_simple_type_specifier(node_cursor c, decl_specifier_seq& seq = decl_specifier_seq()) {
-    if (!seq.type.name.empty()) { // TODO: this is a hack
+    if(!c.is_any_of(first_simple_type_specifier)) return 0;
+    if (seq.type.name != atom_none) { // TODO: this is a hack
         return 0;
     }
     int adv = 0;
@@ -659,7 +1004,7 @@ inline int try_simple_type_specifier(node_cursor c, decl_specifier_seq& seq = de
     int r = try_nested_name_specifier(c, nested_name_spec);
     c.advance(r); adv += r;
     
-    std::string name;
+    atom_t name = atom_none;
     if(r) {
         if(is_tok_adv(c, tok_template, adv)) {
             r = try_simple_template_id(c, name);
@@ -685,31 +1030,31 @@ inline int try_simple_type_specifier(node_cursor c, decl_specifier_seq& seq = de
         return r;
     }
     if(is_tok(c, tok_char)) {
-        seq.type.name = "char";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_char16_t)) {
-        seq.type.name = "char16_t";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_char32_t)) {
-        seq.type.name = "char32_t";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_wchar_t)) {
-        seq.type.name = "wchar_t";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_bool)) {
-        seq.type.name = "bool";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_short)) {
-        seq.type.name = "short";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_int)) {
-        seq.type.name = "int";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_long)) {
@@ -725,24 +1070,24 @@ inline int try_simple_type_specifier(node_cursor c, decl_specifier_seq& seq = de
         return 1;
     }
     if(is_tok(c, tok_float)) {
-        seq.type.name = "float";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_double)) {
-        seq.type.name = "double";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_void)) {
-        seq.type.name = "void";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     if(is_tok(c, tok_auto)) {
-        seq.type.name = "auto";
+        seq.type.name = c.tok()->atom;
         return 1;
     }
     r = try_decltype_specifier(c, name);
     if (r) {
-        seq.type.name = "{UNKNOWN}";
+        seq.type.name = intern("{UNKNOWN}", 9);
     }
     return r;
 }
@@ -789,6 +1134,7 @@ inline int try_trailing_type_specifier(node_cursor c, decl_specifier_seq& seq =
 inline int try_class_specifier(node_cursor c);
 inline int try_enum_specifier(node_cursor c) { return 0; }
 inline int try_type_specifier(node_cursor c, decl_specifier_seq& seq = decl_specifier_seq()) {
+    if(!c.is_any_of(first_type_specifier)) return 0;
     int r = try_trailing_type_specifier(c, seq);
     if(r) return r;
     r = try_class_specifier(c); // TODO
@@ -834,7 +1180,7 @@ inline int try_decl_specifier(node_cursor c, decl_specifier_seq& seq = decl_spec
     }
     return 0;
 }
-inline int try_decl_specifier_seq(node_cursor c, decl_specifier_seq& seq = decl_specifier_seq()) {
+inline int try_decl_specifier_seq_uncached(node_cursor c, decl_specifier_seq& seq) {
     int adv = 0;
     int r = try_decl_specifier(c, seq);
     c.advance(r); adv += r;
@@ -844,16 +1190,22 @@ inline int try_decl_specifier_seq(node_cursor c, decl_specifier_seq& seq = decl_
     if(r) {
         return adv;
     }
-    r = try_decl_specifier_seq(c, seq);
+    r = try_decl_specifier_seq_uncached(c, seq);
     c.advance(r); adv += r;
     return adv;
 }
+inline void memo_merge(decl_specifier_seq& dst, const decl_specifier_seq& src) { dst = src; }
+// seq must be fresh, the result replaces it
+inline int try_decl_specifier_seq(node_cursor c, decl_specifier_seq& seq = decl_specifier_seq()) {
+    if(!c.is_any_of(first_decl_specifier_seq)) return 0;
+    return memoized(c, RULE_DECL_SPECIFIER_SEQ, seq, &try_decl_specifier_seq_uncached);
+}
 
 // === Declarators ====================
 inline int try_template_id(node_cursor c) {
     return 0;
 }
-inline int try_unqualified_id(node_cursor c, std::string& name = std::string()) {
+inline int try_unqualified_id(node_cursor c, atom_t& name) {
     int adv = 0;
     int r = try_template_id(c);
     if(r) return r;
@@ -879,7 +1231,7 @@ inline int try_unqualified_id(node_cursor c, std::string& name = std::string())
     r = try_identifier(c, name);
     return r;
 }
-inline int try_qualified_id(node_cursor c, std::string& name = std::string()) {
+inline int try_qualified_id(node_cursor c, atom_t& name) {
     int adv = 0;
     int r = try_nested_name_specifier(c);
     c.advance(r); adv += r;
@@ -908,13 +1260,14 @@ inline int try_qualified_id(node_cursor c, std::string& name = std::string()) {
         return 0;
     }
 }
-inline int try_id_expression(node_cursor c, std::string& name = std::string()) {
+inline int try_id_expression(node_cursor c, atom_t& name) {
     int r = try_unqualified_id(c, name);
     if(r) return r;
     r = try_qualified_id(c, name);
     return r;
 }
 inline int try_declarator_id(node_cursor c, declarator& decl) {
+    if(!c.is_any_of(first_declarator_id)) return 0;
     int adv = 0;
     int r = 0;
     bool ellipsis = is_tok_adv(c, tok_elipsis, adv);
@@ -934,6 +1287,7 @@ inline int try_declarator_id(node_cursor c, declarator& decl) {
     return 0;    
 }
 inline int try_ptr_operator(node_cursor c) {
+    if(!c.is_any_of(first_ptr_operator)) return 0;
     int adv = 0;
     if(is_tok_adv(c, tok_asterisk, adv)) {
         int r = try_attribute_specifier_seq(c);
@@ -966,6 +1320,7 @@ inline int try_ptr_operator(node_cursor c) {
 }
 inline int try_parameters_and_qualifiers(node_cursor c);
 inline int try_noptr_declarator(node_cursor c, declarator& decl) {
+    if(!c.is_any_of(first_noptr_declarator)) return 0;
     int adv = 0;
     if (c.is_node(node_paren_block)) {
         return 1;
@@ -1063,6 +1418,7 @@ inline int try_trailing_return_type(node_cursor c) {
     return 0;
 }
 inline int try_abstract_declarator(node_cursor c) {
+    if(!c.is_any_of(first_abstract_declarator)) return 0;
     int adv = 0;
     int r = try_ptr_abstract_declarator(c);
     if(r) return r;
@@ -1086,6 +1442,7 @@ inline int try_abstract_declarator(node_cursor c) {
 inline int try_declarator(node_cursor c, init_declarator& decl = init_declarator());
 inline int try_initializer_clause(node_cursor);
 inline int try_parameter_declaration(node_cursor c) {
+    if(!c.is_any_of(first_parameter_declaration)) return 0;
     int adv = 0;
     int r = try_attribute_specifier_seq(c);
     c.advance(r); adv += r;
@@ -1168,7 +1525,7 @@ inline int try_parameters_and_qualifiers(node_cursor c) {
     if(!c.is_node(node_paren_block)) {
         return 0;
     }
-    node_cursor cur_inner(c.n);
+    node_cursor cur_inner = c.inner();
     if(!try_parameter_declaration_clause(cur_inner)) {
         return 0;
     }
@@ -1184,6 +1541,7 @@ inline int try_parameters_and_qualifiers(node_cursor c) {
     return adv;
 }
 inline int try_ptr_declarator(node_cursor c, declarator& decl) {
+    if(!c.is_any_of(first_declarator)) return 0;
     int r = try_noptr_declarator(c, decl);
     if(r) return r;
     
@@ -1197,7 +1555,7 @@ inline int try_ptr_declarator(node_cursor c, declarator& decl) {
     }
     return adv;
 }
-inline int try_declarator(node_cursor c, init_declarator& init_decl) {
+inline int try_declarator_uncached(node_cursor c, init_declarator& init_decl) {
     int adv = 0;
     int r = try_noptr_declarator(c, init_decl.decl);
     c.advance(r); adv += r;
@@ -1216,6 +1574,12 @@ inline int try_declarator(node_cursor c, init_declarator& init_decl) {
     r = try_ptr_declarator(c, init_decl.decl);
     return r;    
 }
+inline void memo_merge(init_declarator& dst, const init_declarator& src) { dst = src; }
+// init_decl must be fresh, the result replaces it
+inline int try_declarator(node_cursor c, init_declarator& init_decl) {
+    if(!c.is_any_of(first_declarator)) return 0;
+    return memoized(c, RULE_DECLARATOR, init_decl, &try_declarator_uncached);
+}
 inline int try_postfix_expression(node_cursor c) {
     return 0;
 }
@@ -1553,6 +1917,7 @@ inline int try_brace_or_equal_initializer(node_cursor c) {
     return adv;
 }
 inline int try_initializer(node_cursor c) {
+    if(!c.is_any_of(first_initializer)) return 0;
     int r = try_brace_or_equal_initializer(c);
     if(r) return r;
     if(c.is_node(node_paren_block)) {
@@ -1589,7 +1954,7 @@ inline int try_init_declarator_list(node_cursor c, init_declarator_list& list) {
 // === simple-declaration =============
 
 inline int try_simple_declaration(node_cursor c, simple_declaration& decl = simple_declaration()) {
-    int start = c.idx;
+    const node_cursor start = c;
     int adv = 0;
     int r = try_attribute_specifier_seq(c, decl.attributes);
     c.advance(r); adv += r;
@@ -1614,18 +1979,7 @@ inline int try_simple_declaration(node_cursor c, simple_declaration& decl = simp
         decl.print();
         printf("\n");
         printf("\tunparsed: ");
-        for(int i = start; i < start + adv; ++i) {
-            node* n = c.sequence->nodes[i].get();
-            if(n->type == node_token) {
-                printf("%s ", n->tok->get_string().c_str());
-            } else if(n->type == node_brace_block) {
-                printf("{ ... } ");
-            } else if(n->type == node_bracket_block) {
-                printf("[ ... ] ");
-            } else if(n->type == node_paren_block) {
-                printf("( ... ) ");
-            }
-        }
+        start.print_some(adv);
         printf("\n");
     }
     return adv;
@@ -1686,7 +2040,7 @@ inline int try_function_definition(node_cursor c, function_definition& def = fun
 
 struct class_definition {
     nested_name_specifier nested_name_spec;
-    std::string name;
+    atom_t name = atom_none;
     base_clause base;
     attribute_specifier_seq attribs;
     bool is_final;
@@ -1732,18 +2086,24 @@ inline int try_class_head_b(node_cursor c, class_definition& def = class_definit
     c.advance(r); adv += r;
 
     def.is_final = false;
-    def.name = "";
+    def.name = atom_none;
     
     r = try_base_clause(c, def.base);
     c.advance(r); adv += r;
     return adv;
 }
-inline int try_class_head(node_cursor c, class_definition& def = class_definition()) {
+inline int try_class_head_uncached(node_cursor c, class_definition& def) {
     int r = try_class_head_a(c, def);
     if(r) return r;
     r = try_class_head_b(c, def);
     return r;
 }
+inline void memo_merge(class_definition& dst, const class_definition& src) { dst = src; }
+// def must be fresh, the result replaces it
+inline int try_class_head(node_cursor c, class_definition& def = class_definition()) {
+    if(!c.is_any_of(first_class_head)) return 0;
+    return memoized(c, RULE_CLASS_HEAD, def, &try_class_head_uncached);
+}
 inline int try_class_specifier(node_cursor c) {
     class_definition def;
     int adv = 0;
@@ -1755,21 +2115,64 @@ inline int try_class_specifier(node_cursor c) {
 
     printf("class-specifier: ");
     if(!def.nested_name_spec.names.empty()) {
-        for(int i = 0; i < def.nested_name_spec.names.size(); ++i) {
-            printf("%s::", def.nested_name_spec.names[i].c_str());
+        for(size_t i = 0; i < def.nested_name_spec.names.size(); ++i) {
+            printf("%s::", atom_string(def.nested_name_spec.names[i]));
         }
     }
-    printf("%s", def.name.c_str());
+    printf("%s", atom_string(def.name));
     if(!def.base.specifiers.empty()) {
-        printf(", base classes(%i): ", def.base.specifiers.size());
-        for(int i = 0; i < def.base.specifiers.size(); ++i) {
-            printf("(%s) ", def.base.specifiers[i].class_name.c_str());
+        printf(", base classes(%i): ", (int)def.base.specifiers.size());
+        for(size_t i = 0; i < def.base.specifiers.size(); ++i) {
+            printf("(%s) ", atom_string(def.base.specifiers[i].class_name));
         }
     }
     printf("\n");
     return adv;
 }
 
+// === declaration ====================
+
+enum DECLARATION_FORM : uint8_t {
+    FORM_CLASS_SPECIFIER        = 0x01,
+    FORM_SIMPLE_DECLARATION     = 0x02,
+    FORM_FUNCTION_DEFINITION    = 0x04
+};
+// Forms a declaration starting with an item of each kind can take
+struct declaration_dispatch_table {
+    uint8_t forms[256];
+};
+constexpr declaration_dispatch_table make_declaration_dispatch_table() {
+    declaration_dispatch_table table = {};
+    for(int i = 0; i < 256; ++i) {
+        token_type kind = (token_type)i;
+        table.forms[i] = (uint8_t)(
+            (first_class_specifier.has(kind) ? FORM_CLASS_SPECIFIER : 0)
+            | (first_simple_declaration.has(kind) ? FORM_SIMPLE_DECLARATION : 0)
+            | (first_function_definition.has(kind) ? FORM_FUNCTION_DEFINITION : 0)
+        );
+    }
+    return table;
+}
+constexpr declaration_dispatch_table declaration_dispatch = make_declaration_dispatch_table();
+
+// Tries the forms in order, skipping the ones that can't start with the current item
+inline int try_declaration(node_cursor c) {
+    uint8_t forms = declaration_dispatch.forms[c.kind()];
+    int r = 0;
+    if(forms & FORM_CLASS_SPECIFIER) {
+        r = try_class_specifier(c);
+        if(r) return r;
+    }
+    if(forms & FORM_SIMPLE_DECLARATION) {
+        r = try_simple_declaration(c);
+        if(r) return r;
+    }
+    if(forms & FORM_FUNCTION_DEFINITION) {
+        r = try_function_definition(c);
+    }
+    return r;
+}
+
 } // cppi
 
 
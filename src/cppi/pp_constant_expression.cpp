@@ -1,445 +1,358 @@
 #include "pp_constant_expression.hpp"
-#include "pp_token_cursor.hpp"
 
-#include "pp_ast.hpp"
-#include "tokenize.hpp"
+#include "log_internal.hpp"
 
 namespace cppi {
 
-int pp_try_integer_literal(pp_token_cursor& cur) {
-    if(cur.is_tok(tok_int_literal)) {
-        return 1;
-    }
-    return 0;
-}
-int pp_try_character_literal(pp_token_cursor& cur) {
-    if(cur.is_tok(tok_char_constant)) {
-        return 1;
-    }
-    return 0;
+struct pp_eval_state {
+    const pp_token* tok;
+    const pp_token* end;
+};
+
+static token_type peek(const pp_eval_state& s) {
+    return s.tok < s.end ? s.tok->tok.type : tok_eof;
 }
-int pp_try_floating_literal(pp_token_cursor& cur) {
-    if(cur.is_tok(tok_float_literal)) {
-        return 1;
-    }
-    return 0;
+
+static pp_value make_signed(intmax_t v) {
+    pp_value r;
+    r.bits = (uintmax_t)v;
+    r.is_unsigned = false;
+    return r;
 }
-int pp_try_string_literal(pp_token_cursor& cur) {
-    if(cur.is_tok(tok_string_constant)) {
-        return 1;
+
+// 0 if not a binary operator
+static int binary_precedence(token_type type) {
+    switch(type) {
+    case tok_asterisk: case tok_fwd_slash: case tok_percent: return 10;
+    case tok_plus: case tok_minus: return 9;
+    case tok_shift_left: case tok_shift_right: return 8;
+    case tok_less: case tok_more: case tok_less_assign: case tok_more_assign: return 7;
+    case tok_equals: case tok_excl_assign: return 6;
+    case tok_amp: return 5;
+    case tok_hat: return 4;
+    case tok_pipe: return 3;
+    case tok_double_amp: return 2;
+    case tok_double_pipe: return 1;
+    default: return 0;
     }
-    return 0;
 }
-int pp_try_boolean_literal(pp_token_cursor& cur) {
-    if(cur.is_identifier("true")) {
-        return 1;
-    } else if(cur.is_identifier("false")) {
-        return 1;
-    }
-    return 0;
+
+static int digit_value(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
 }
-int pp_try_pointer_literal(pp_token_cursor& cur) {
-    if(cur.is_identifier("nullptr")) {
-        return 1;
+
+static bool parse_integer_literal(const char* str, size_t len, pp_value& out) {
+    size_t i = 0;
+    int base = 10;
+    if(len > 1 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        i = 2;
+    } else if(len > 1 && str[0] == '0' && (str[1] == 'b' || str[1] == 'B')) {
+        base = 2;
+        i = 2;
+    } else if(str[0] == '0') {
+        base = 8;
     }
-    return 0;
-}
-int pp_try_user_defined_literal(pp_token_cursor& cur) {
-    return 0;
-}
-int pp_try_literal(pp_token_cursor cur, ast_node& node) {
-    int r = pp_try_integer_literal(cur);
-    if(r) {
-        node.type = ast_lit_int;
-        node.eval_type = ast_lit_int;
-        node.as_int = cur.get_tok()->to_int();
-        return r;
+    uintmax_t value = 0;
+    bool overflow = false;
+    for(; i < len; ++i) {
+        if(str[i] == '\'') {
+            continue;
+        }
+        int d = digit_value(str[i]);
+        if(d < 0 || d >= base) {
+            break;
+        }
+        if(value > (UINTMAX_MAX - d) / base) {
+            overflow = true;
+        }
+        value = value * base + d;
     }
-    r = pp_try_character_literal(cur);
-    if(r) {
-        node.type = ast_lit_char;
-        node.eval_type = ast_lit_char;
-        node.as_char = cur.get_tok()->to_char();
-        return r;
+    bool is_unsigned = false;
+    for(; i < len; ++i) {
+        char c = str[i];
+        if(c == 'u' || c == 'U') {
+            is_unsigned = true;
+        } else if(c != 'l' && c != 'L' && c != 'z' && c != 'Z') {
+            LOG_ERR("invalid integer literal '%.*s'", (int)len, str);
+            return false;
+        }
     }
-    r = pp_try_floating_literal(cur);
-    if(r) {
-        node.type = ast_lit_float;
-        node.eval_type = ast_lit_float;
-        node.as_float = cur.get_tok()->to_float();
-        return r;
+    if(overflow) {
+        LOG_WARN("integer literal '%.*s' is too large", (int)len, str);
     }
-    r = pp_try_string_literal(cur);
-    if(r) {
-        node.type = ast_lit_string;
-        node.eval_type = ast_lit_string;
-        // TODO cur.get_tok()->to_string() ?
-        return r;
+    out.bits = value;
+    out.is_unsigned = is_unsigned || value > (uintmax_t)INTMAX_MAX;
+    return true;
+}
+
+static bool parse_character_literal(const char* str, size_t len, pp_value& out) {
+    // Encoding prefix is not part of the token
+    size_t i = 1;
+    size_t end = len > 1 && str[len - 1] == '\'' ? len - 1 : len;
+    intmax_t value = 0;
+    int count = 0;
+    while(i < end) {
+        int c = (unsigned char)str[i++];
+        if(c == '\\' && i < end) {
+            c = (unsigned char)str[i++];
+            switch(c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'a': c = '\a'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'v': c = '\v'; break;
+            case 'x': {
+                c = 0;
+                while(i < end && digit_value(str[i]) >= 0) {
+                    c = c * 16 + digit_value(str[i++]);
+                }
+                break;
+            }
+            default:
+                if(c >= '0' && c <= '7') {
+                    c -= '0';
+                    for(int n = 0; n < 2 && i < end && str[i] >= '0' && str[i] <= '7'; ++n) {
+                        c = c * 8 + (str[i++] - '0');
+                    }
+                }
+                // \\, \', \", \? stand for themselves
+                break;
+            }
+        }
+        value = (value << 8) | (c & 0xFF);
+        ++count;
     }
-    r = pp_try_boolean_literal(cur);
-    if(r) {
-        node.type = ast_lit_bool;
-        node.eval_type = ast_lit_bool;
-        node.as_bool = cur.get_tok()->to_bool();
-        return r;
+    if(count == 0) {
+        LOG_ERR("empty character literal");
+        return false;
     }
-    r = pp_try_pointer_literal(cur);
-    if(r) {
-        node.type = ast_lit_ptr;
-        node.eval_type = ast_lit_ptr;
-        node.as_int = 0;
-        return r;
+    if(count == 1) {
+        value = (signed char)value;
     }
-    r = pp_try_user_defined_literal(cur);
-    node.type = ast_unk; // TODO ?
-    return r;
+    out = make_signed(value);
+    return true;
 }
-int pp_try_constant_expression(pp_token_cursor cur, ast_node& node);
-int pp_try_primary_expression(pp_token_cursor cur, ast_node& node) {
-    int r = pp_try_literal(cur, node);
-    if(r) {
-        return r;
+
+static bool eval_conditional(pp_eval_state& s, pp_value& out, bool evaluate);
+
+static bool eval_unary(pp_eval_state& s, pp_value& out, bool evaluate) {
+    token_type type = peek(s);
+    switch(type) {
+    case tok_plus:
+    case tok_minus:
+    case tok_tilde:
+    case tok_excl: {
+        ++s.tok;
+        pp_value v;
+        if(!eval_unary(s, v, evaluate)) {
+            return false;
+        }
+        out = v;
+        if(type == tok_minus) {
+            out.bits = 0 - v.bits;
+        } else if(type == tok_tilde) {
+            out.bits = ~v.bits;
+        } else if(type == tok_excl) {
+            out = make_signed(!v.is_true());
+        }
+        return true;
     }
-    int adv = 0;
-    if(cur.is_tok(tok_paren_l)) {
-        cur.advance(); adv++;
-        r = pp_try_constant_expression(cur, node);
-        cur.advance(r); adv += r;
-        if(!cur.is_tok(tok_paren_r)) {
-            return 0;
+    case tok_paren_l:
+        ++s.tok;
+        if(!eval_conditional(s, out, evaluate)) {
+            return false;
+        }
+        if(peek(s) != tok_paren_r) {
+            LOG_ERR("expected ')' in preprocessor expression");
+            return false;
         }
-        cur.advance(); adv++;
-        return adv;
+        ++s.tok;
+        return true;
+    case tok_int_literal: {
+        // The lexer splits numbers like 0x1F or 10u into several tokens, join the pieces that touch
+        const token& first = s.tok->tok;
+        const char* str = first.str();
+        size_t len = first.length;
+        ++s.tok;
+        while(s.tok < s.end
+            && (s.tok->tok.type == tok_literal || s.tok->tok.type == tok_int_literal)
+            && s.tok->tok.file == first.file && s.tok->tok.offset == first.offset + len
+        ) {
+            len += s.tok->tok.length;
+            ++s.tok;
+        }
+        return parse_integer_literal(str, len, out);
     }
-    return 0;
-}
-
-int pp_try_unary_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    int r = pp_try_primary_expression(cur, node);
-    if(r) return r;
-
-    if(cur.is_tok(tok_incr)) {
-        // TODO: err
-        return 0;
-    } else if(cur.is_tok(tok_decr)) {
-        // TODO: err
-        return 0;
-    } else if(cur.is_tok(tok_asterisk)) {
-        // TODO: err
-        return 0;
-    } else if(cur.is_tok(tok_amp)) {
-        // TODO: err
-        return 0;
-    } else if(cur.is_tok(tok_plus)) {
-        node.type = ast_unary_plus;
-    } else if(cur.is_tok(tok_minus)) {
-        node.type = ast_unary_minus;
-    } else if(cur.is_tok(tok_excl)) {
-        node.type = ast_unary_logic_not;
-    } else if(cur.is_tok(tok_tilde)) {
-        node.type = ast_unary_not;
-    } else {
-        return 0;
+    case tok_char_constant: {
+        const token& tok = s.tok->tok;
+        ++s.tok;
+        return parse_character_literal(tok.str(), tok.length, out);
     }
-    cur.advance(); adv++;
-    ast_node operand;
-    r = pp_try_unary_expression(cur, operand);
-    cur.advance(r); adv += r;
-    if(!r) {
-        return 0;
+    case tok_identifier:
+        // Whatever is left after macro expansion is 0, except for the boolean literals
+        out = make_signed(s.tok->tok.atom == atom_true ? 1 : 0);
+        ++s.tok;
+        return true;
+    case tok_float_literal:
+        LOG_ERR("floating point literal in preprocessor expression");
+        return false;
+    case tok_eof:
+        LOG_ERR("expected an expression");
+        return false;
+    default:
+        LOG_ERR("unexpected '%s' in preprocessor expression", s.tok->tok.get_string().c_str());
+        return false;
     }
-    node.set_right(operand);
-    return adv;
 }
 
-int pp_try_multiplicative_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_unary_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-    if(cur.is_tok(tok_asterisk)) {
-        cur.advance(); adv++;
-        node.type = ast_mul;
-    } else if(cur.is_tok(tok_fwd_slash)) {
-        cur.advance(); adv++;
-        node.type = ast_div;
-    } else if(cur.is_tok(tok_percent)) {
-        cur.advance(); adv++;
-        node.type = ast_div_rem;
-    } else {
-        node = node_a;
-        return adv;
+static bool apply_binary(token_type op, pp_value& lhs, const pp_value& rhs, bool evaluate) {
+    // Shifts keep the type of the left operand, the rest use the usual arithmetic conversions
+    bool is_unsigned = lhs.is_unsigned || rhs.is_unsigned;
+    uintmax_t a = lhs.bits;
+    uintmax_t b = rhs.bits;
+    switch(op) {
+    case tok_asterisk: lhs.bits = a * b; break;
+    case tok_plus: lhs.bits = a + b; break;
+    case tok_minus: lhs.bits = a - b; break;
+    case tok_fwd_slash:
+    case tok_percent:
+        if(b == 0) {
+            if(evaluate) {
+                LOG_ERR("division by zero in preprocessor expression");
+                return false;
+            }
+            lhs.bits = 0;
+        } else if(is_unsigned) {
+            lhs.bits = op == tok_fwd_slash ? a / b : a % b;
+        } else if((intmax_t)b == -1) {
+            // INTMAX_MIN / -1 overflows
+            lhs.bits = op == tok_fwd_slash ? 0 - a : 0;
+        } else {
+            intmax_t r = op == tok_fwd_slash ? (intmax_t)a / (intmax_t)b : (intmax_t)a % (intmax_t)b;
+            lhs.bits = (uintmax_t)r;
+        }
+        break;
+    case tok_shift_left:
+    case tok_shift_right: {
+        bool negative_count = !rhs.is_unsigned && (intmax_t)b < 0;
+        uintmax_t count = negative_count ? 0 - b : b;
+        bool left = (op == tok_shift_left) != negative_count;
+        const uintmax_t bit_count = sizeof(uintmax_t) * 8;
+        if(left) {
+            lhs.bits = count >= bit_count ? 0 : a << count;
+        } else if(lhs.is_unsigned || (intmax_t)a >= 0) {
+            lhs.bits = count >= bit_count ? 0 : a >> count;
+        } else {
+            // Arithmetic shift of a negative value
+            lhs.bits = count >= bit_count ? ~(uintmax_t)0 : ~(~a >> count);
+        }
+        return true;
     }
-    ast_node node_b;
-    r = pp_try_multiplicative_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
-}
-int pp_try_additive_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_multiplicative_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-    if(cur.is_tok(tok_plus)) {
-        cur.advance(); adv++;
-        node.type = ast_plus;
-    } else if(cur.is_tok(tok_minus)) {
-        cur.advance(); adv++;
-        node.type = ast_minus;
-    } else {
-        node = node_a;
-        return adv;
+    case tok_less:
+    case tok_more:
+    case tok_less_assign:
+    case tok_more_assign: {
+        int cmp;
+        if(is_unsigned) {
+            cmp = a < b ? -1 : (a > b ? 1 : 0);
+        } else {
+            cmp = (intmax_t)a < (intmax_t)b ? -1 : ((intmax_t)a > (intmax_t)b ? 1 : 0);
+        }
+        bool r = op == tok_less ? cmp < 0 : op == tok_more ? cmp > 0 : op == tok_less_assign ? cmp <= 0 : cmp >= 0;
+        lhs = make_signed(r);
+        return true;
     }
-    ast_node node_b;
-    r = pp_try_additive_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
-}
-int pp_try_shift_expession(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_additive_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_shift_left)) {
-        cur.advance(); adv++;
-        node.type = ast_shift_left;
-    } else if(cur.is_tok(tok_shift_right)) {
-        cur.advance(); adv++;
-        node.type = ast_shift_right;
-    } else {
-        node = node_a;
-        return adv;
+    case tok_equals: lhs = make_signed(a == b); return true;
+    case tok_excl_assign: lhs = make_signed(a != b); return true;
+    case tok_amp: lhs.bits = a & b; break;
+    case tok_hat: lhs.bits = a ^ b; break;
+    case tok_pipe: lhs.bits = a | b; break;
+    case tok_double_amp: lhs = make_signed(a != 0 && b != 0); return true;
+    case tok_double_pipe: lhs = make_signed(a != 0 || b != 0); return true;
+    default:
+        return false;
     }
-    ast_node node_b;
-    r = pp_try_shift_expession(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
+    lhs.is_unsigned = is_unsigned;
+    return true;
 }
-int pp_try_relational_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_shift_expession(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_less)) {
-        cur.advance(); adv++;
-        node.type = ast_less;
-    } else if(cur.is_tok(tok_more)) {
-        cur.advance(); adv++;
-        node.type = ast_more;
-    } else if(cur.is_tok(tok_less_assign)) {
-        cur.advance(); adv++;
-        node.type = ast_less_eq;
-    } else if(cur.is_tok(tok_more_assign)) {
-        cur.advance(); adv++;
-        node.type = ast_more_eq;
-    } else {
-        node = node_a;
-        return adv;
-    }
-    ast_node node_b;
-    r = pp_try_relational_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
 
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
-}
-int pp_try_equality_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_relational_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_equals)) {
-        cur.advance(); adv++;
-        node.type = ast_equal;
-    } else if(cur.is_tok(tok_excl_assign)) {
-        cur.advance(); adv++;
-        node.type = ast_not_equal;
-    } else {
-        node = node_a;
-        return adv;
+// Folds operators of precedence min_prec and up into lhs
+static bool eval_binary(pp_eval_state& s, pp_value& lhs, int min_prec, bool evaluate) {
+    while(true) {
+        token_type op = peek(s);
+        int prec = binary_precedence(op);
+        if(prec == 0 || prec < min_prec) {
+            return true;
+        }
+        ++s.tok;
+        // Right side of a decided && or || is parsed but not evaluated
+        bool rhs_evaluate = evaluate;
+        if(op == tok_double_amp) {
+            rhs_evaluate = evaluate && lhs.is_true();
+        } else if(op == tok_double_pipe) {
+            rhs_evaluate = evaluate && !lhs.is_true();
+        }
+        pp_value rhs;
+        if(!eval_unary(s, rhs, rhs_evaluate)) {
+            return false;
+        }
+        if(!eval_binary(s, rhs, prec + 1, rhs_evaluate)) {
+            return false;
+        }
+        if(!apply_binary(op, lhs, rhs, rhs_evaluate)) {
+            return false;
+        }
     }
-    ast_node node_b;
-    r = pp_try_equality_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
 }
-int pp_try_and_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_equality_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_amp)) {
-        cur.advance(); adv++;
-    } else {
-        node = node_a;
-        return adv;
-    }
-    ast_node node_b;
-    r = pp_try_and_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.type = ast_and;
-    node.set_left(node_a);
-    node.set_right(node_b);
 
-    return adv;
-}
-int pp_try_exclusive_or_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_and_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_hat)) {
-        cur.advance(); adv++;
-    } else {
-        node = node_a;
-        return adv;
+static bool eval_conditional(pp_eval_state& s, pp_value& out, bool evaluate) {
+    if(!eval_unary(s, out, evaluate)) {
+        return false;
     }
-    ast_node node_b;
-    r = pp_try_exclusive_or_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.type = ast_excl_or;
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
-}
-int pp_try_inclusive_or_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_exclusive_or_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_pipe)) {
-        cur.advance(); adv++;
-    } else {
-        node = node_a;
-        return adv;
+    if(!eval_binary(s, out, 1, evaluate)) {
+        return false;
     }
-    ast_node node_b;
-    r = pp_try_inclusive_or_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.type = ast_or;
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
-}
-int pp_try_logical_and_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_inclusive_or_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_double_amp)) {
-        cur.advance(); adv++;
-    } else {
-        node = node_a;
-        return adv;
+    if(peek(s) != tok_question) {
+        return true;
     }
-    ast_node node_b;
-    r = pp_try_logical_and_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.type = ast_logic_and;
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
-}
-int pp_try_logical_or_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_logical_and_expression(cur, node_a);
-    cur.advance(r); adv+=r;
-    if(cur.is_tok(tok_double_pipe)) {
-        cur.advance(); adv++;
-    } else {
-        node = node_a;
-        return adv;
+    ++s.tok;
+    bool cond = out.is_true();
+    pp_value a;
+    pp_value b;
+    if(!eval_conditional(s, a, evaluate && cond)) {
+        return false;
     }
-    ast_node node_b;
-    r = pp_try_logical_or_expression(cur, node_b);
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node.type = ast_logic_or;
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
-}
-int pp_try_conditional_expression(pp_token_cursor cur, ast_node& node) {
-    int adv = 0;
-    ast_node node_a;
-    int r = pp_try_logical_or_expression(cur, node_a);
-    cur.advance(r); adv += r;
-    if(cur.is_tok(tok_question)) {
-        cur.advance(); adv++;
-    } else {
-        node = node_a;
-        return adv;
+    if(peek(s) != tok_colon) {
+        LOG_ERR("expected ':' in preprocessor expression");
+        return false;
     }
-
-    ast_node node_b;
-    ast_node node_b_a;
-    r = pp_try_constant_expression(cur, node_b_a); // TODO 'expression', not 'constant-expression'
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-    if(!cur.is_tok(tok_colon)) {
-        return 0;
+    ++s.tok;
+    if(!eval_conditional(s, b, evaluate && !cond)) {
+        return false;
     }
-    cur.advance(); adv++;
-    
-    ast_node node_b_b;
-    r = pp_try_conditional_expression(cur, node_b_b); // TODO 'assignment-expression', not 'conditional-expression'
-    cur.advance(r); adv += r;
-    if(!r) return 0;
-
-    node_b.type = ast_conditional_options;
-    node_b.set_left(node_b_a);
-    node_b.set_right(node_b_b);
-
-    node.type = ast_conditional;
-    node.set_left(node_a);
-    node.set_right(node_b);
-
-    return adv;
+    out = cond ? a : b;
+    out.is_unsigned = a.is_unsigned || b.is_unsigned;
+    return true;
 }
 
-int pp_try_constant_expression(pp_token_cursor cur, ast_node& node) {
-    int r = pp_try_conditional_expression(cur, node);
-    return r;   
+bool pp_evaluate_expression(const pp_token* tokens, size_t count, pp_value& out) {
+    pp_eval_state s;
+    s.tok = tokens;
+    s.end = tokens + count;
+    if(!eval_conditional(s, out, true)) {
+        return false;
+    }
+    if(s.tok != s.end) {
+        LOG_ERR("unexpected '%s' in preprocessor expression", s.tok->tok.get_string().c_str());
+        return false;
+    }
+    return true;
 }
 
-} // cppi
\ No newline at end of file
+}
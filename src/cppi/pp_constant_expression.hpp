@@ -1,15 +1,24 @@
 #ifndef CPPI_PREPROCESSOR_CONSTANT_EXPRESSION_HPP
 #define CPPI_PREPROCESSOR_CONSTANT_EXPRESSION_HPP
 
-#include <vector>
-#include "pp_token_cursor.hpp"
-#include "pp_ast.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include "pp_input.hpp"
 
 
 namespace cppi {
 
-int  pp_try_constant_expression(pp_token_cursor cur, ast_node& node = ast_node());
-bool pp_eval_constant_expression(const std::vector<token>& tokens, int& out);
+// Value of an #if expression, arithmetic is done in intmax_t or uintmax_t
+struct pp_value {
+    uintmax_t   bits = 0; // two's complement if signed
+    bool        is_unsigned = false;
+
+    bool is_true() const { return bits != 0; }
+};
+
+// tokens must be macro-expanded, with defined already replaced and no whitespace
+// Evaluated in a single pass by precedence climbing, nothing is allocated
+bool pp_evaluate_expression(const pp_token* tokens, size_t count, pp_value& out);
 
 }
 
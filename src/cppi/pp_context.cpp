@@ -1,11 +1,12 @@
 #include "pp_context.hpp"
 
 #include <cctype>
+#include <string.h>
 #include "tokenize.hpp"
 #include "pp_constant_expression.hpp"
 #include "file_util.hpp"
-#include "pp_token_cursor.hpp"
-#include "pp_ast.hpp"
+#include "pp_output.hpp"
+#include "file_cache.hpp"
 #include "log_internal.hpp"
 
 
@@ -29,302 +30,178 @@ std::string pp_dir_name_from_path(const std::string& path) {
     return std::string(_path.data(), _path.data() + last_slash + 1);
 }
 
-bool pp_context::is_macro_already_expanding(const std::string& name) {
-    for(auto& e : expansion_stack) {
-        if(name == e) {
-            return true;
+bool pp_context::pp_expand_and_evaluate(const std::vector<token>& tokens, bool& out) {
+    // Expanded in place, the evaluator works on the resulting tokens directly
+    std::vector<pp_token>& expr = expression_tokens;
+    expr.clear();
+    pp_input in(tokens.data(), tokens.size());
+    auto eat_whitespace = [&in](){
+        while(in.current().type == tok_whitespace || in.current().type == tok_newline) {
+            in.advance();
         }
-    }
-    return false;
-}
-
-bool pp_context::pp_eval_constant_expression(const std::vector<token>& tokens, int& out) {
-    std::vector<char> preprocessed_expr;
-    if(!preprocess(tokens, preprocessed_expr, "", true)) {
-        return false;
-    }
-    std::vector<token> preprocessed_tokens;
-    tokenize(preprocessed_expr, preprocessed_tokens);
-    
-    std::vector<token> tokens_no_whitespace;
-    for(int i = 0; i < preprocessed_tokens.size(); ++i) {
-        if(preprocessed_tokens[i].type == tok_whitespace || preprocessed_tokens[i].type == tok_newline) {
+    };
+    while(true) {
+        eat_whitespace();
+        const token& tok = in.current();
+        if(tok.type == tok_eof) {
+            break;
+        }
+        if(tok.type == tok_identifier && tok.atom == atom_defined) {
+            in.advance();
+            eat_whitespace();
+            bool parenthesized = false;
+            if(in.current().type == tok_paren_l) {
+                parenthesized = true;
+                in.advance();
+                eat_whitespace();
+            }
+            if(in.current().type != tok_identifier) {
+                LOG_ERR("expected an identifier");
+                return false;
+            }
+            pp_token t = in.take();
+            bool is_defined = find_macro(t.tok.atom) != nullptr;
+            if(parenthesized) {
+                eat_whitespace();
+                if(in.current().type != tok_paren_r) {
+                    LOG_ERR("exprected closing parenthesis");
+                    return false;
+                }
+                in.advance();
+            }
+            t.tok.type = tok_int_literal;
+            t.tok.length = 1;
+            if(!expansion_text.store(is_defined ? "1" : "0", 1, t.tok.file, t.tok.offset)) {
+                return false;
+            }
+            t.tok.atom = atom_none;
+            expr.push_back(t);
             continue;
         }
-        tokens_no_whitespace.push_back(preprocessed_tokens[i]);
+        if(tok.type == tok_identifier) {
+            const pp_macro* macro = find_macro(tok.atom);
+            if(macro && !hidesets.contains(in.current_hideset(), tok.atom)) {
+                bool expanded = false;
+                if(!expand_macro(in, *macro, expanded)) {
+                    return false;
+                }
+                if(expanded) {
+                    continue;
+                }
+            }
+        }
+        expr.push_back(in.take());
     }
 
-    pp_token_cursor cur(tokens_no_whitespace);
-    
-    ast_node node;
-    int r = pp_try_constant_expression(cur, node);
-    for(int i = 0; i < r; ++i) {
-        printf("%s ", tokens_no_whitespace[i].get_string().c_str());
+    pp_value value;
+    if(!pp_evaluate_expression(expr.data(), expr.size(), value)) {
+        return false;
     }
-    printf("\n");
-    printf("result: ");
-    node.eval();
-    if(node.eval_type == ast_lit_int) { printf("%i", node.as_int); }
-    else if(node.eval_type == ast_lit_char) { printf("%c", node.as_char); }
-    else if(node.eval_type == ast_lit_float) { printf("%f", node.as_float); }
-    else if(node.eval_type == ast_lit_bool) { node.as_bool ? printf("true") : printf("false"); }
-    else { assert(false); }
-    printf("\n");
-
-    if(node.eval_type == ast_lit_int) { out = node.as_int; }
-    else if(node.eval_type == ast_lit_char) { out = node.as_char; }
-    else if(node.eval_type == ast_lit_float) { out = node.as_float; }
-    else if(node.eval_type == ast_lit_bool) { out = node.as_bool; }
-    else { return false; }
+    out = value.is_true();
     return true;
 }
 
-std::vector<char> pp_context::pp_string_constant_from_tokens(const std::vector<token>& tokens) {
-    // TODO: Unfinished, check standard
-    std::vector<char> out;
-    
-    token tok = tokens[0];
-    size_t cur = 0;
-    auto advance = [&tokens, &tok, &cur](){
-        if(cur == tokens.size() - 1) { tok.type = tok_eof;}
-        else { tok = tokens[++cur]; }
-    };
-    auto is_tok = [&tok](token_type type) -> bool { return tok.type == type; };
-    auto emit_and_advance = [&advance, &tok, &out](){
-        out.insert(out.end(), tok.string, tok.string + tok.length);
-        advance();
-    };
-
-    out.push_back('"');
-    while(!is_tok(tok_eof)) {
-        if(is_tok(tok_whitespace) || is_tok(tok_newline)) {
-            while(is_tok(tok_whitespace) || is_tok(tok_newline)) {
-                advance();
-            }
-            out.push_back(' ');
-            continue;
-        }
-        if(is_tok(tok_string_constant)) {
-            out.push_back(92); // \ 
-            out.push_back(34); // "
-            out.insert(out.end(), tok.string + 1, tok.string + tok.length - 1);
-            out.push_back(92); // \ 
-            out.push_back(34); // "
-            advance();
+bool pp_context::pp_eval_constant_expression(const std::vector<token>& tokens, bool& out) {
+    std::string expression;
+    for(auto& tok : tokens) {
+        if(tok.type == tok_whitespace || tok.type == tok_newline) {
             continue;
         }
-        emit_and_advance();
+        expression.append(tok.str(), tok.length);
+        expression.push_back(' ');
     }
-    if(out.back() == ' ') {
-        out.pop_back();
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(char c : expression) {
+        hash ^= (uint8_t)c;
+        hash *= 1099511628211ull;
     }
-    out.push_back('"');
-
-    return out;
-}
-
-std::vector<char> pp_context::pp_string_from_tokens(const std::vector<token>& tokens) {
-    std::vector<char> out;
 
-    for(int i = 0; i < tokens.size(); ++i) {
-        auto t = tokens[i];
-        if(t.type == tok_whitespace || t.type == tok_newline) {
-            while(t.type == tok_whitespace || t.type == tok_newline) {
-                ++i;
-                if(i == tokens.size() - 1) {
-                    break;
-                }
-                t = tokens[i];
+    auto it = if_cache.find(hash);
+    if(it != if_cache.end() && it->second.expression == expression) {
+        bool valid = true;
+        for(auto& dep : it->second.dependencies) {
+            if(macros.generation(dep.first) != dep.second) {
+                valid = false;
+                break;
             }
-            out.push_back(' ');
-            --i;
-        } else {
-            out.insert(out.end(), t.string, t.string + t.length);
+        }
+        if(valid) {
+            stats.if_cache_hits++;
+            out = it->second.result;
+            return true;
         }
     }
-    if(!out.empty() && out.back() == ' ') {
-        out.pop_back(); 
+    stats.if_cache_misses++;
+
+    std::vector<atom_t> lookups;
+    macro_lookups = &lookups;
+    bool result = false;
+    bool ok = pp_expand_and_evaluate(tokens, result);
+    macro_lookups = 0;
+    if(!ok) {
+        return false;
     }
 
-    return out;
-}
-
-bool pp_context::process_replacement_list(const pp_macro& macro, std::vector<char>& out, const std::vector<std::vector<token>>& macro_args, const std::vector<token>& va_args) {
-    if(macro.replacement_list.empty()) {
-        return true;
+    std::sort(lookups.begin(), lookups.end());
+    lookups.erase(std::unique(lookups.begin(), lookups.end()), lookups.end());
+    pp_if_cache_entry& entry = if_cache[hash];
+    entry.expression = expression;
+    entry.dependencies.clear();
+    for(auto name : lookups) {
+        entry.dependencies.push_back(std::make_pair(name, macros.generation(name)));
     }
-    
-    token tok = macro.replacement_list[0];
-    size_t cur = 0;
-    auto advance = [&macro, &tok, &cur](){
-        if(cur == macro.replacement_list.size() - 1) { tok.type = tok_eof;}
-        else { tok = macro.replacement_list[++cur]; }
-    };
-    auto reset = [&macro, &tok, &cur](){
-        tok = macro.replacement_list[0];
-        cur = 0;
-    };
-    auto is_tok = [&tok](token_type type) -> bool { return tok.type == type; };
-    auto get_param_idx = [&is_tok, &macro, &tok]() -> int {
-        if(!is_tok(tok_identifier)) {
-            return -1;
-        }
-        if(!macro.has_parameter_list) {
-            return -1;
-        }
-        int idx = 0;
-        for(auto& param : macro.parameters) {
-            if(param.get_string().compare(tok.get_string()) == 0) {
-                return idx;
-            }
-            ++idx;
-        }
-        return -1;
-    };
-    auto emit_tok = [&out](const token& tok){
-        out.insert(out.end(), tok.string, tok.string + tok.length);
-    };
-    auto emit_and_advance = [&advance, &tok, &out](){
-        out.insert(out.end(), tok.string, tok.string + tok.length);
-        advance();
-    };
-    auto emit_buf = [&out](const std::vector<char>& str){
-        out.insert(out.end(), str.begin(), str.end());
-    };
-
-    // handle # and ## operators, and expand parameters
-    int param_idx = 0;
-    while(!is_tok(tok_eof)) {
-        if(is_tok(tok_hash)) {
-            advance();
-            int param_idx = get_param_idx();
-            if(param_idx < 0) {
-                if(tok.get_string() == "__VA_ARGS__") {
-                    std::vector<char> str = pp_string_constant_from_tokens(va_args);
-                    emit_buf(str);
-                    advance();
-                } else {
-                    LOG_ERR("token after # must be a macro parameter");
-                    return false;
-                }
-            } else {
-                std::vector<char> stringified_arg;
-                if(param_idx >= macro_args.size()) {
-                    // TODO: WARNING: Not enough parameters
-                    stringified_arg = { '"', '"' };
-                } else {
-                    stringified_arg = pp_string_constant_from_tokens(macro_args[param_idx]);                
-                }
-                emit_buf(stringified_arg);
-                advance();
-            }
-        } else if(tok.get_string() == "__VA_ARGS__") {
-            std::vector<char> str = pp_string_from_tokens(va_args);
-            emit_buf(str);
-            advance();
-        } else if((param_idx = get_param_idx()) >= 0) {
-            if(param_idx >= macro_args.size()) {
-                // TODO: WARNING: Not enough parameters
-                // do nothing
-                advance();
-            } else {
-                std::vector<char> str = pp_string_from_tokens(macro_args[param_idx]);
-                emit_buf(str);
-                advance();
-            }
-        } else {
-            emit_and_advance();
-        }
-
-        if(is_tok(tok_double_hash)) {
-            advance();
-        } else if(is_tok(tok_whitespace)) {
-            token whitespace_tok = tok;
-            advance();
-            if(is_tok(tok_double_hash)) {
-                advance();
-                if(is_tok(tok_whitespace)) {
-                    advance();
-                }
-            } else {
-                emit_tok(whitespace_tok);
-            }
-        }
-    }
-
-    std::vector<token> local_tokens;
-    tokenize(out, local_tokens);
-    std::vector<char> local_buf;
-    preprocess(local_tokens, local_buf);
-    out = local_buf;
+    entry.result = result;
+    out = result;
     return true;
 }
 
-bool pp_context::preprocess(
-    const std::vector<token>& tokens, 
-    std::vector<char>& out_buf,
-    const std::string& full_fpath, 
-    bool constant_expression, 
-    bool include_line
-) {
-    std::string full_file_path = full_fpath;
-    if(full_file_path.empty()) {
-        full_file_path = ".";
+pp_context::pp_frame& pp_context::push_frame(const std::string& full_fpath, const directive_index* directives) {
+    if(frame_count == frames.size()) {
+        frames.emplace_back();
     }
-    bool ignore_directives = constant_expression || include_line;
-
-    token tok = tokens[0];
-    size_t cur = 0;
-    enum {
-        PP_DEFAULT, PP_DIRECTIVE,
-        PP_INCLUDE, PP_DEFINE, PP_UNDEF, PP_LINE, PP_ERROR, PP_PRAGMA,
-        PP_IF, PP_IFDEF, PP_IFNDEF, PP_ELIF, PP_ELSE, PP_ENDIF
-    } pp_state = PP_DEFAULT;
-    bool fresh_line = true;
-
-    auto advance = [&tokens, &tok, &cur](){
-        if(cur == tokens.size() - 1) { tok.type = tok_eof;}
-        else { tok = tokens[++cur]; }
-    };
-    auto go_back = [&tokens, &tok, &cur](int count){
-        cur -= count;
-        if(cur >= tokens.size()) { tok.type = tok_eof; }
-        else { tok = tokens[cur]; }
+    pp_frame& f = frames[frame_count++];
+    f.directives = directives;
+    f.full_file_path = full_fpath.empty() ? "." : full_fpath;
+    f.include_name.clear();
+    f.fresh_line = true;
+    f.directive_pos = 0;
+    return f;
+}
+
+bool pp_context::run(size_t count) {
+    pp_output& out = output;
+    pp_frame* f = &frames[frame_count - 1];
+    token tok = f->input.current();
+
+    auto advance = [&f, &tok](){
+        f->input.advance();
+        tok = f->input.current();
     };
-    auto emit_token_and_advance = [this, &advance, &out_buf, &tokens, &tok, &cur](){
+    auto emit_token_and_advance = [this, &advance, &f, &out, &tok](){
         if(pp_token_group_enabled) {
-            out_buf.insert(out_buf.end(), tok.string, tok.string + tok.length);
+            if(tok.type == tok_newline) {
+                out.newline();
+            } else if(tok.type == tok_whitespace) {
+                out.space();
+            } else {
+                // Tokens coming out of macro expansion carry their spacing as a flag
+                if(f->input.is_rescanned() && f->input.current_space_before()) {
+                    out.space();
+                }
+                out.emit(tok);
+            }
         }
         advance();
     };
-    auto emit_string = [&out_buf](const std::string& str){
-        out_buf.insert(out_buf.end(), str.begin(), str.end());
-    };
-    auto emit_char_array = [&out_buf](const std::vector<char>& buf){
-        out_buf.insert(out_buf.end(), buf.begin(), buf.end());
-    };
-    auto emit_tokens = [&out_buf](const std::vector<token>& tokens){
-        for(int i = 0; i < tokens.size(); ++i) {
-            auto& tok = tokens[i];
-            out_buf.insert(out_buf.end(), tok.string, tok.string + tok.length);
-        }
-    };
     auto is_tok = [&tok](token_type type) -> bool {
         return tok.type == type;
     };
-    auto eat_whitespace = [&advance, &is_tok, &tokens, &tok, &cur](){
+    auto eat_whitespace = [&advance, &is_tok](){
         while(is_tok(tok_whitespace)) {
             advance();
         }
     };
-    auto eat_whitespace_and_newline = [&advance, &is_tok, &tokens, &tok, &cur]()->int{
-        int count = 0;
-        while(is_tok(tok_whitespace) || is_tok(tok_newline)) {
-            advance();
-            ++count;
-        }
-        return count;
-    };
     auto is_group_enabled = [this]()->bool{
         if(conditional_stack.empty()) {
             return true;
@@ -337,6 +214,21 @@ bool pp_context::preprocess(
         }
         return conditional_stack.back().group_enabled && parent_state;
     };
+    // Jump from a directive that disabled its group to the one that ends it,
+    // tokens in between are never looked at
+    auto skip_disabled_group = [this, &f, &tok](){
+        if(pp_token_group_enabled || !f->directives) {
+            return;
+        }
+        uint32_t next = f->directives->find_next((uint32_t)f->directive_pos);
+        if(next == cond_directive::NONE) {
+            return;
+        }
+        f->input.seek(next);
+        tok = f->input.current();
+        f->fresh_line = true;
+        stats.skipped_groups++;
+    };
     auto is_parent_group_enabled = [this]()->bool{
         if(conditional_stack.empty()) {
             return true;
@@ -349,518 +241,533 @@ bool pp_context::preprocess(
         }
         return parent_state;
     };
+    // Back to the file that included the current one, right after its #include
+    auto pop_frame = [this, &f, &tok](){
+        if(!f->include_name.empty()) {
+            printf("include %s\n", f->include_name.c_str());
+        }
+        --frame_count;
+        if(frame_count == 0) {
+            return;
+        }
+        f = &frames[frame_count - 1];
+        tok = f->input.current();
+        pp_state = PP_DEFAULT;
+    };
 
-    while(tok.type != tok_eof) {
-        switch(pp_state) {
-        case PP_DEFAULT:
-            if(is_tok(tok_newline)) {
-                fresh_line = true;
+    // One step of the innermost file, false on error
+    auto step = [&]()->bool{
+            switch(pp_state) {
+            case PP_DEFAULT:
+                if(is_tok(tok_newline)) {
+                    f->fresh_line = true;
+                    emit_token_and_advance();
+                    return true;
+                } else if(is_tok(tok_whitespace) && !f->input.is_rescanned()) {
+                    // Directives can be indented
+                    emit_token_and_advance();
+                    return true;
+                } else if(is_tok(tok_hash) && f->fresh_line && !f->input.is_rescanned()) {
+                    pp_state = PP_DIRECTIVE;
+                    f->directive_pos = f->input.position();
+                    advance();
+                    return true;
+                } else if(is_tok(tok_identifier)) {
+                    const pp_macro* macro = macros.find(tok.atom);
+                    if(pp_token_group_enabled && macro && !hidesets.contains(f->input.current_hideset(), tok.atom)) {
+                        bool expanded = false;
+                        if(!expand_macro(f->input, *macro, expanded)) {
+                            return false;
+                        }
+                        if(expanded) {
+                            // Replacement is rescanned together with the rest of the input
+                            tok = f->input.current();
+                            f->fresh_line = false;
+                            return true;
+                        }
+                        // Function-like macro name without an argument list, not an invocation
+                    }
+                    // Not a macro invocation
+                    f->fresh_line = false;
+                    emit_token_and_advance();
+                    return true;
+                }
+                f->fresh_line = false;
                 emit_token_and_advance();
-                continue;
-            } else if(is_tok(tok_hash) && fresh_line) {
-                if(ignore_directives) {
-                    LOG_ERR("# is unexprected in a constant expression");
+                break;
+            case PP_DIRECTIVE:
+                eat_whitespace();
+                if(is_tok(tok_newline)) {
+                    pp_state = PP_DEFAULT;
+                    break;
+                }
+                if(!is_tok(tok_identifier)) {
+                    LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
                     return false;
                 }
-                pp_state = PP_DIRECTIVE;
-                advance();
-                continue;
-            } else if(is_tok(tok_identifier)) {
-                if(constant_expression && tok_name_match(tok, "defined")) {
+                if(pp_token_group_enabled && tok.atom == atom_include) {
+                    pp_state = PP_INCLUDE;
+                    advance();
+                } else if(pp_token_group_enabled && tok.atom == atom_define) {
+                    pp_state = PP_DEFINE;
+                    advance();
+                    break;
+                } else if(pp_token_group_enabled && tok.atom == atom_undef) {
+                    pp_state = PP_UNDEF;
+                    advance();
+                    break;
+                } else if(tok.atom == atom_if) {
+                    pp_state = PP_IF;
                     advance();
-                    eat_whitespace();
-                    bool parenthesized = false;
-                    if(is_tok(tok_paren_l)) {
-                        parenthesized = true;
+                    break;
+                } else if(tok.atom == atom_ifdef) {
+                    pp_state = PP_IFDEF;
+                    advance();
+                    break;
+                } else if(tok.atom == atom_ifndef) {
+                    pp_state = PP_IFNDEF;
+                    advance();
+                    break;
+                } else if(tok.atom == atom_else) {
+                    pp_state = PP_ELSE;
+                    advance();
+                    break;
+                } else if(tok.atom == atom_elif) {
+                    pp_state = PP_ELIF;
+                    advance();
+                    break;
+                } else if(tok.atom == atom_endif) {
+                    pp_state = PP_ENDIF;
+                    advance();
+                    break;
+                } else if(pp_token_group_enabled && tok.atom == atom_pragma) {
+                    pp_state = PP_PRAGMA;
+                    advance();
+                    break;
+                } else {
+                    while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                        print_tok(tok);
                         advance();
-                        eat_whitespace();
                     }
-                    if(!is_tok(tok_identifier)) {
-                        LOG_ERR("expected an identifier");
+                    printf("\n");
+                    pp_state = PP_DEFAULT;
+                }
+                break;
+            case PP_INCLUDE: {
+                eat_whitespace();
+                std::vector<token> incl_tokens;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    incl_tokens.push_back(tok);
+                    advance();
+                }
+                pp_output incl_out;
+                if(!expand_line(incl_tokens, incl_out)) {
+                    LOG_ERR("failed to preprocess tokens after #include");
+                    return false;
+                }
+                std::vector<char> buf;
+                write_tokens_text(incl_out, buf);
+                if(buf.empty()) {
+                    LOG_ERR("missing file path for #include");
+                    return false;
+                }
+                bool is_quotes;
+                if(buf[0] == '\"') {
+                    is_quotes = true;
+                } else if(buf[0] == '<') {
+                    is_quotes = false;
+                } else {
+                    LOG_ERR("expected \" or < for #include");
+                    return false;
+                }
+                std::string fname;
+                int fname_len = 0;
+                for(int i = 1; i < buf.size(); ++i) {
+                    if(is_quotes && buf[i] == '\"') {
+                        break;
+                    } else if(!is_quotes && buf[i] == '>') {
+                        break;
+                    }
+                    ++fname_len;
+                }
+                if(fname_len == buf.size() - 1) {
+                    LOG_ERR("missing closing \" or > for #include");
+                    return false;
+                }
+                fname = std::string(buf.data() + 1, buf.data() + 1 + fname_len);
+                if(fname.empty()) {
+                    LOG_ERR("file name required for #include");
+                    return false;
+                }
+
+                if(is_quotes) {
+                    std::string dir = pp_dir_name_from_path(f->full_file_path);
+                    std::string new_fname = dir + "\\" + fname;
+                    
+                    bool cache_hit = false;
+                    auto file = file_cache::get().load(new_fname.c_str(), &cache_hit);
+                    if(!file) {
+                        LOG_ERR("can't find include file '%s'", fname.c_str());
                         return false;
                     }
-                    bool is_defined = macros.find(tok.get_string()) != macros.end();
-                    if(parenthesized) {
-                        advance();
-                        eat_whitespace();
-                        if(!is_tok(tok_paren_r)) {
-                            LOG_ERR("exprected closing parenthesis");
-                            return false;
-                        }
+                    stats.include_count++;
+                    if(cache_hit) {
+                        stats.include_cache_hits++;
                     }
-                    if(is_defined) {
-                        emit_string("1");
+                    if(once_files.count(file->path)) {
+                        stats.pragma_once_skips++;
+                    } else if(file->guard_macro != atom_none && macros.is_defined(file->guard_macro)) {
+                        stats.include_guard_skips++;
                     } else {
-                        emit_string("0");
+                        if(frame_count >= max_include_depth) {
+                            LOG_ERR("#include nested too deeply (limit is %d)", (int)max_include_depth);
+                            return false;
+                        }
+                        // Kept alive for as long as macros defined in it can reference its tokens
+                        included_files.push_back(file);
+
+                        // Appends straight to the shared output, starting on a new line
+                        // Continues in the included file, this one resumes once it is done
+                        out.newline();
+                        pp_state = PP_DEFAULT;
+                        f = &push_frame(file->path, &file->directives);
+                        f->input.reset(file->tokens.data(), file->tokens.size());
+                        f->include_name = fname;
+                        tok = f->input.current();
+                        return true;
                     }
-                    advance();
-                    continue;
+                } else {
+                    // TODO
                 }
-                auto it = macros.find(tok.get_string());
-                if(it != macros.end() && !is_macro_already_expanding(it->second.name)) {
-                    advance(); 
-                    // revert_count is used to move cursor back if no opening parenthesis was found
-                    int revert_count = eat_whitespace_and_newline();
-                    if(it->second.has_parameter_list && is_tok(tok_paren_l)) {
-                        advance(); eat_whitespace_and_newline();
-                        std::vector<std::vector<token>> macro_args;
-                        std::vector<token> va_args;
-                        std::vector<token> arg;
-                        int open_paren_count = 1;
-                        if(is_tok(tok_paren_r)) {
-                            advance();
-                            continue;
-                        } else {
-                            while(true) {
-                                if(is_tok(tok_eof)) {
-                                    LOG_ERR("macro invocation missing closing parenthesis (reached eof)");
-                                    return false;
-                                }
-                                if(is_tok(tok_paren_r)) {
-                                    open_paren_count--;
-                                    if(open_paren_count == 0) {
-                                        if(macro_args.size() < it->second.parameters.size()) {
-                                            macro_args.push_back(arg);
-                                            advance();
-                                        } else {
-                                            va_args = arg;
-                                            advance();
-                                        }
-                                        break;
-                                    }
-                                }
-                                if(open_paren_count == 1 && is_tok(tok_comma)) {
-                                    if(macro_args.size() < it->second.parameters.size()) {
-                                        macro_args.push_back(arg);
-                                        arg.clear();
-                                        advance(); eat_whitespace_and_newline();
-                                    } else {
-                                        arg.push_back(tok);
-                                        advance();
-                                    }
-                                    continue;
-                                }
-                                if(is_tok(tok_paren_l)) {
-                                    open_paren_count++;
-                                }
-                                arg.push_back(tok);
-
-                                advance();
-                            }
-                        }
-                        if(!macro_args.empty()) {
-                            for(auto& arg : macro_args) {
-                                while(!arg.empty() && arg.back().type == tok_whitespace && arg.back().type == tok_newline) {
-                                    arg.pop_back();
-                                }
-                            }
-                        }
-                        std::vector<char> replacement;
-                        expansion_stack.push_back(it->second.name);
-                        if(!process_replacement_list(it->second, replacement, macro_args, va_args)) {
+
+                printf("include %s\n", fname.c_str());
+                pp_state = PP_DEFAULT;
+                break;
+            }
+            case PP_DEFINE: {
+                eat_whitespace();
+                if(!is_tok(tok_identifier)) {
+                    LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
+                    return false;
+                }
+                pp_macro def;
+                std::vector<atom_t> parameters;
+                def.name = tok.atom;
+                advance();
+                if(is_tok(tok_paren_l)) {
+                    advance(); eat_whitespace();
+                    def.has_parameter_list = true;
+                    while(!is_tok(tok_paren_r)) {
+                        if(!is_tok(tok_identifier) && !is_tok(tok_elipsis)) {
+                            LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
                             return false;
                         }
-                        expansion_stack.pop_back();
-                        emit_char_array(replacement);
-                        fresh_line = false;
-                        continue;
-                    } else if(it->second.has_parameter_list) {
-                        // Macro invocation missing argument list
-                        // treat as a non-macro identifier
-                        go_back(revert_count);
-                        fresh_line = false;
-                        if(constant_expression) {
-                            emit_string("0");
-                            advance();
-                        } else {
-                            emit_string(it->second.name);
-                            advance();
+                        if(is_tok(tok_elipsis)) {
+                            advance(); eat_whitespace();
+                            def.has_variadic_param = true;
+                            break;
                         }
-                        continue;
-                    } else {
-                        // Object-like macro invocation
-                        std::vector<char> replacement;
-                        expansion_stack.push_back(it->second.name);
-                        if(!process_replacement_list(it->second, replacement)) {
-                            return false;
+                        parameters.push_back(tok.atom);
+                        advance(); eat_whitespace();
+                        if(is_tok(tok_comma)) {
+                            advance(); eat_whitespace();
+                            continue;
+                        } else {
+                            break;
                         }
-                        expansion_stack.pop_back();
-                        emit_char_array(replacement);
-                        fresh_line = false;
-                        go_back(revert_count);
-                        continue;
                     }
-                } else {
-                    // Not a macro identifier
-                    fresh_line = false;
-                    if(!constant_expression) {
-                        emit_token_and_advance();
-                    } else {
-                        emit_string("0");
-                        advance();
+                    if(!is_tok(tok_paren_r)) {
+                        LOG_ERR("expected ')'");
+                        return false;
                     }
-                    continue;
+                    advance();
                 }
-            }
-            fresh_line = false;
-            emit_token_and_advance();
-            break;
-        case PP_DIRECTIVE:
-            eat_whitespace();
-            if(is_tok(tok_newline)) {
+                std::vector<token> replacement_list;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    replacement_list.push_back(tok);
+                    advance();
+                }
+                if(!compile_macro(macros.get_arena(), def, parameters, replacement_list)) {
+                    return false;
+                }
+                const pp_macro* prev = macros.find(def.name);
+                if(prev && !is_same_macro_definition(*prev, def)) {
+                    LOG_WARN("'%s' macro redefinition", atom_string(def.name));
+                }
+                macros.define(def);
                 pp_state = PP_DEFAULT;
                 break;
             }
-            if(!is_tok(tok_identifier)) {
-                LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
-                return false;
-            }
-            if(pp_token_group_enabled && tok_name_match(tok, "include")) {
-                pp_state = PP_INCLUDE;
-                advance();
-            } else if(pp_token_group_enabled && tok_name_match(tok, "define")) {
-                pp_state = PP_DEFINE;
-                advance();
-                break;
-            } else if(pp_token_group_enabled && tok_name_match(tok, "undef")) {
-                pp_state = PP_UNDEF;
-                advance();
-                break;
-            } else if(tok_name_match(tok, "if")) {
-                pp_state = PP_IF;
-                advance();
-                break;
-            } else if(tok_name_match(tok, "ifdef")) {
-                pp_state = PP_IFDEF;
-                advance();
-                break;
-            } else if(tok_name_match(tok, "ifndef")) {
-                pp_state = PP_IFNDEF;
-                advance();
-                break;
-            } else if(tok_name_match(tok, "else")) {
-                pp_state = PP_ELSE;
-                advance();
-                break;
-            } else if(tok_name_match(tok, "elif")) {
-                pp_state = PP_ELIF;
-                advance();
-                break;
-            } else if(tok_name_match(tok, "endif")) {
-                pp_state = PP_ENDIF;
-                advance();
-                break;
-            } else {
+            case PP_PRAGMA: {
+                eat_whitespace();
+                if(tok.atom == atom_once) {
+                    std::string canonical;
+                    if(canonical_path(f->full_file_path.c_str(), canonical)) {
+                        once_files.insert(canonical);
+                    }
+                }
                 while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                    print_tok(tok);
                     advance();
                 }
-                printf("\n");
                 pp_state = PP_DEFAULT;
+                break;
             }
-            break;
-        case PP_INCLUDE: {
-            eat_whitespace();
-            std::vector<token> incl_tokens;
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                incl_tokens.push_back(tok);
+            case PP_UNDEF: {
+                eat_whitespace();
+                if(!is_tok(tok_identifier)) {
+                    LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
+                    return false;
+                }
+                macros.undef(tok.atom);
                 advance();
-            }
-            std::vector<char> buf;
-            if(!preprocess(incl_tokens, buf, "", false, true)) {
-                LOG_ERR("failed to preprocess tokens after #include");
-                return false;
-            }
-            if(buf.empty()) {
-                LOG_ERR("missing file path for #include");
-                return false;
-            }
-            bool is_quotes;
-            if(buf[0] == '\"') {
-                is_quotes = true;
-            } else if(buf[0] == '<') {
-                is_quotes = false;
-            } else {
-                LOG_ERR("expected \" or < for #include");
-                return false;
-            }
-            std::string fname;
-            int fname_len = 0;
-            for(int i = 1; i < buf.size(); ++i) {
-                if(is_quotes && buf[i] == '\"') {
-                    break;
-                } else if(!is_quotes && buf[i] == '>') {
-                    break;
+                bool has_unexpected_tokens = false;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    has_unexpected_tokens = true;
+                    advance();
                 }
-                ++fname_len;
-            }
-            if(fname_len == buf.size() - 1) {
-                LOG_ERR("missing closing \" or > for #include");
-                return false;
-            }
-            fname = std::string(buf.data() + 1, buf.data() + 1 + fname_len);
-            if(fname.empty()) {
-                LOG_ERR("file name required for #include");
-                return false;
+                if(has_unexpected_tokens) {
+                    // TODO: Warning
+                }
+                pp_state = PP_DEFAULT;
+                break;
             }
-
-            if(is_quotes) {
-                std::string dir = pp_dir_name_from_path(full_file_path);
-                std::string new_fname = dir + "\\" + fname;
-                
-                std::vector<char> fbuf;
-                if(!load_file(new_fname.c_str(), fbuf)) {
-                    LOG_ERR("can't find include file '%s'", fname.c_str());
+            case PP_IF: {
+                eat_whitespace();
+                std::vector<token> expr_tokens;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    expr_tokens.push_back(tok);
+                    advance();
+                }
+                // Not evaluated inside a disabled group
+                bool val = false;
+                if(pp_token_group_enabled && !pp_eval_constant_expression(expr_tokens, val)) {
+                    LOG_ERR("failed to evaluate constant expression");
                     return false;
                 }
+                bool group_enabled = val;
 
-                std::vector<token> _pp_tokens;
-                tokenize(fbuf, _pp_tokens);
-                std::vector<char> _preprocessed_buffer;
-                preprocess(_pp_tokens, _preprocessed_buffer, new_fname);
-                emit_char_array(_preprocessed_buffer);
-            } else {
-                // TODO
-            }
+                pp_cond_state cond_state;
+                cond_state.type = COND_IF;
+                cond_state.group_enabled = group_enabled && pp_token_group_enabled;
+                cond_state.one_condition_already_satisfied = cond_state.group_enabled || !pp_token_group_enabled;
+                conditional_stack.push_back(cond_state);
+                pp_token_group_enabled = cond_state.group_enabled;
 
-            printf("include %s\n", fname.c_str());
-            pp_state = PP_DEFAULT;
-            break;
-        }
-        case PP_DEFINE: {
-            eat_whitespace();
-            if(!is_tok(tok_identifier)) {
-                LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
-                return false;
+                pp_state = PP_DEFAULT;
+                skip_disabled_group();
+                break;
             }
-            auto& def = macros[tok.get_string()];
-            def.name = tok.get_string();
-            advance();
-            if(is_tok(tok_paren_l)) {
-                advance(); eat_whitespace();
-                def.has_parameter_list = true;
-                while(!is_tok(tok_paren_r)) {
-                    if(!is_tok(tok_identifier) && !is_tok(tok_elipsis)) {
-                        LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
-                        return false;
-                    }
-                    if(is_tok(tok_elipsis)) {
-                        advance(); eat_whitespace();
-                        def.has_variadic_param = true;
-                        break;
-                    }
-                    def.parameters.push_back(tok);
-                    advance(); eat_whitespace();
-                    if(is_tok(tok_comma)) {
-                        advance(); eat_whitespace();
-                        continue;
-                    } else {
-                        break;
-                    }
-                }
-                if(!is_tok(tok_paren_r)) {
-                    LOG_ERR("expected ')'");
+            case PP_IFDEF: {
+                eat_whitespace();
+                if(!is_tok(tok_identifier)) {
+                    LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
                     return false;
                 }
-                advance();
-            }
-            eat_whitespace();
-            if(is_tok(tok_double_hash)) {
-                LOG_ERR("macro replacement list can't start with '##'");
-                return false;
-            }
-            bool last_token_is_double_hash = false;
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                def.replacement_list.push_back(tok);
-                if(is_tok(tok_double_hash)) {
-                    last_token_is_double_hash = true;
-                } else if(!is_tok(tok_whitespace)) {
-                    last_token_is_double_hash = false;
+                bool group_enabled = macros.is_defined(tok.atom);
+
+                pp_cond_state cond_state;
+                cond_state.type = COND_IF;
+                cond_state.group_enabled = group_enabled && pp_token_group_enabled;
+                cond_state.one_condition_already_satisfied = cond_state.group_enabled || !pp_token_group_enabled;
+                conditional_stack.push_back(cond_state);
+                pp_token_group_enabled = cond_state.group_enabled;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    advance();
                 }
-                advance();
-            }
-            if(last_token_is_double_hash) {
-                LOG_ERR("macro replacement list can't end with '##'");
-                return false;
-            }
-            pp_state = PP_DEFAULT;
-            break;
-        }
-        case PP_UNDEF: {
-            eat_whitespace();
-            if(!is_tok(tok_identifier)) {
-                LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
-                return false;
-            }
-            macros.erase(tok.get_string());
-            advance();
-            bool has_unexpected_tokens = false;
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                has_unexpected_tokens = true;
-                advance();
-            }
-            if(has_unexpected_tokens) {
-                // TODO: Warning
-            }
-            pp_state = PP_DEFAULT;
-            break;
-        }
-        case PP_IF: {
-            eat_whitespace();
-            std::vector<token> expr_tokens;
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                expr_tokens.push_back(tok);
-                advance();
+                pp_state = PP_DEFAULT;
+                skip_disabled_group();
+                break;
             }
-            int val;
-            if(!pp_eval_constant_expression(expr_tokens, val)) {
-                LOG_ERR("failed to evaluate constant expression");
-                return false;
+            case PP_IFNDEF: {
+                eat_whitespace();
+                if(!is_tok(tok_identifier)) {
+                    LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
+                    return false;
+                }
+                bool group_enabled = !macros.is_defined(tok.atom);
+
+                pp_cond_state cond_state;
+                cond_state.type = COND_IF;
+                cond_state.group_enabled = group_enabled && pp_token_group_enabled;
+                cond_state.one_condition_already_satisfied = cond_state.group_enabled || !pp_token_group_enabled;
+                conditional_stack.push_back(cond_state);
+                pp_token_group_enabled = cond_state.group_enabled;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    advance();
+                }
+                pp_state = PP_DEFAULT;
+                skip_disabled_group();
+                break;
             }
-            bool group_enabled = val != 0;
+            case PP_ELSE: {
+                if(conditional_stack.empty()) {
+                    LOG_ERR("unexpected else directive");
+                    return false;
+                }
+                auto& cond_state = conditional_stack.back();
+                if(cond_state.type != COND_ELIF && cond_state.type != COND_IF) {
+                    LOG_ERR("unexpected else directive");
+                    return false;
+                }
 
-            pp_cond_state cond_state;
-            cond_state.type = COND_IF;
-            cond_state.group_enabled = group_enabled && pp_token_group_enabled;
-            cond_state.one_condition_already_satisfied = cond_state.group_enabled || !pp_token_group_enabled;
-            conditional_stack.push_back(cond_state);
-            pp_token_group_enabled = cond_state.group_enabled;
+                cond_state.type = COND_ELSE;
+                cond_state.group_enabled = !cond_state.one_condition_already_satisfied && is_parent_group_enabled();
+                pp_token_group_enabled = cond_state.group_enabled;
 
-            pp_state = PP_DEFAULT;
-            break;
-        }
-        case PP_IFDEF: {
-            eat_whitespace();
-            if(!is_tok(tok_identifier)) {
-                LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
-                return false;
-            }
-            auto it = macros.find(tok.get_string());
-            bool group_enabled = it != macros.end();
-
-            pp_cond_state cond_state;
-            cond_state.type = COND_IF;
-            cond_state.group_enabled = group_enabled && pp_token_group_enabled;
-            cond_state.one_condition_already_satisfied = cond_state.group_enabled || !pp_token_group_enabled;
-            conditional_stack.push_back(cond_state);
-            pp_token_group_enabled = cond_state.group_enabled;
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                advance();
-            }
-            pp_state = PP_DEFAULT;
-            break;
-        }
-        case PP_IFNDEF: {
-            eat_whitespace();
-            if(!is_tok(tok_identifier)) {
-                LOG_ERR("expected an identifier, got '%s'", tok.get_string().c_str());
-                return false;
-            }
-            auto it = macros.find(tok.get_string());
-            bool group_enabled = it == macros.end();
-
-            pp_cond_state cond_state;
-            cond_state.type = COND_IF;
-            cond_state.group_enabled = group_enabled && pp_token_group_enabled;
-            cond_state.one_condition_already_satisfied = cond_state.group_enabled || !pp_token_group_enabled;
-            conditional_stack.push_back(cond_state);
-            pp_token_group_enabled = cond_state.group_enabled;
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                advance();
-            }
-            pp_state = PP_DEFAULT;
-            break;
-        }
-        case PP_ELSE: {
-            if(conditional_stack.empty()) {
-                LOG_ERR("unexpected else directive");
-                return false;
-            }
-            auto& cond_state = conditional_stack.back();
-            if(cond_state.type != COND_ELIF && cond_state.type != COND_IF) {
-                LOG_ERR("unexpected else directive");
-                return false;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    advance();
+                }
+                pp_state = PP_DEFAULT;
+                skip_disabled_group();
+                break;
             }
+            case PP_ELIF: {
+                if(conditional_stack.empty()) {
+                    LOG_ERR("unexpected else directive");
+                    return false;
+                }
+                auto& cond_state = conditional_stack.back();
+                if(cond_state.type != COND_ELIF && cond_state.type != COND_IF) {
+                    LOG_ERR("unexpected else directive");
+                    return false;
+                }
+                eat_whitespace();
+                std::vector<token> expr_tokens;
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    expr_tokens.push_back(tok);
+                    advance();
+                }
+                // Not evaluated once a group of the chain was taken
+                bool val = false;
+                bool evaluate = !cond_state.one_condition_already_satisfied && is_parent_group_enabled();
+                if(evaluate && !pp_eval_constant_expression(expr_tokens, val)) {
+                    LOG_ERR("failed to evaluate constant expression");
+                    return false;
+                }
+                bool group_enabled = val;
 
-            cond_state.type = COND_ELSE;
-            cond_state.group_enabled = !cond_state.one_condition_already_satisfied && is_parent_group_enabled();
-            pp_token_group_enabled = cond_state.group_enabled;
+                cond_state.type = COND_ELIF;
+                cond_state.group_enabled = group_enabled && evaluate;
+                cond_state.one_condition_already_satisfied |= cond_state.group_enabled;
+                pp_token_group_enabled = cond_state.group_enabled;
 
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                advance();
-            }
-            pp_state = PP_DEFAULT;
-            break;
-        }
-        case PP_ELIF: {
-            if(conditional_stack.empty()) {
-                LOG_ERR("unexpected else directive");
-                return false;
-            }
-            auto& cond_state = conditional_stack.back();
-            if(cond_state.type != COND_ELIF && cond_state.type != COND_IF) {
-                LOG_ERR("unexpected else directive");
-                return false;
-            }
-            eat_whitespace();
-            std::vector<token> expr_tokens;
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                expr_tokens.push_back(tok);
-                advance();
+                pp_state = PP_DEFAULT;
+                skip_disabled_group();
+                break;
             }
-            int val;
-            if(!pp_eval_constant_expression(expr_tokens, val)) {
-                LOG_ERR("failed to evaluate constant expression");
-                return false;
+            case PP_ENDIF:
+                if(conditional_stack.empty()) {
+                    LOG_ERR("unexpected endif directive");
+                    return false;
+                }
+                conditional_stack.pop_back();
+                pp_token_group_enabled = is_group_enabled();
+                while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
+                    advance();
+                }
+                pp_state = PP_DEFAULT;
+                break;
             }
-            bool group_enabled = val != 0;
-
-            cond_state.type = COND_ELIF;
-            cond_state.group_enabled = group_enabled && !cond_state.one_condition_already_satisfied && is_parent_group_enabled();
-            pp_token_group_enabled = cond_state.group_enabled;
+        return true;
+    };
 
-            pp_state = PP_DEFAULT;
-            break;
+    while(frame_count > 0 && out.size() < count) {
+        if(tok.type == tok_eof) {
+            pop_frame();
+            continue;
         }
-        case PP_ENDIF:
-            if(conditional_stack.empty()) {
-                LOG_ERR("unexpected endif directive");
+        if(!step()) {
+            // An error only ends the file it is in, the includer carries on
+            if(frame_count == 1) {
                 return false;
             }
-            conditional_stack.pop_back();
-            pp_token_group_enabled = is_parent_group_enabled();
-            while(!is_tok(tok_newline) && !is_tok(tok_eof)) {
-                advance();
-            }
-            pp_state = PP_DEFAULT;
-            break;
+            pop_frame();
         }
     }
     return true;
 }
 
 bool pp_context::preprocess(const char* buffer, size_t length, const char* full_file_path_hint) {
-    std::vector<char> buf(buffer, buffer + length);
-    std::vector<token> pp_tokens;
-    if(!tokenize(buf, pp_tokens)) {
+    if(!start(buffer, length, full_file_path_hint)) {
         return false;
     }
+    while(!done()) {
+        if(!pull(pp_output::CHUNK_SIZE)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    if(!preprocess(pp_tokens, preprocessed_buffer, full_file_path_hint)) {
+bool pp_context::start(const char* buffer, size_t length, const char* full_file_path_hint) {
+    // Nothing carries over from the previous translation unit
+    running = false;
+    macros.clear();
+    included_files.clear();
+    once_files.clear();
+    conditional_stack.clear();
+    pp_token_group_enabled = true;
+    stats = pp_stats();
+    if_cache.clear();
+    hidesets.clear();
+    expansion_text.clear();
+    // Also on failure, the tokens of the last run may point into a buffer that is gone
+    output.clear();
+    preprocessed_text.clear();
+    main_lexer.reset();
+
+    main_source.reset(buffer, length, full_file_path_hint);
+    if(main_source.get() == source_none) {
         return false;
     }
+    if(length > UINT32_MAX) {
+        printf("%s is too large, token offsets are 32 bit\n", source_name(main_source.get()).c_str());
+        return false;
+    }
+    // Lexed as it is preprocessed, so only the lookahead of the root file is held as tokens
+    // Disabled groups in it are stepped through, there is no directive index to jump with
+    main_lexer.reset(new lexer(main_source.get(), 0, length));
+    main_path = full_file_path_hint ? full_file_path_hint : "";
+    frame_count = 0;
+    push_frame(main_path, 0).input.reset(main_lexer.get());
+    pp_state = PP_DEFAULT;
+    running = true;
+    return true;
+}
 
-    // Debug
-    dump_buffer(preprocessed_buffer, (std::string(full_file_path_hint) + ".pp").c_str());
-
+bool pp_context::pull(size_t count) {
+    if(!running) {
+        return true;
+    }
+    if(!run(output.size() + count)) {
+        running = false;
+        main_lexer.reset();
+        return false;
+    }
+    if(frame_count == 0) {
+        finish();
+    }
     return true;
 }
 
+void pp_context::finish() {
+    running = false;
+    main_lexer.reset();
+    output.push_eof();
+
+    if(text_output || dump_text) {
+        write_tokens_text(output, preprocessed_text);
+    }
+    if(dump_text) {
+        dump_buffer(preprocessed_text, (main_path + ".pp").c_str());
+    }
+}
+
 size_t pp_context::get_preprocessed_length() const {
-    return preprocessed_buffer.size();
+    return preprocessed_text.size();
 }
 const char* pp_context::get_preprocessed_buffer() const {
-    return preprocessed_buffer.data();
+    return preprocessed_text.data();
 }
 
 }
\ No newline at end of file
@@ -2,26 +2,52 @@
 #define CPP_INSPECTOR_PREPROCESSOR_CONTEXT_HPP
 
 #include <string>
+#include <deque>
 #include <map>
+#include <unordered_set>
+#include <unordered_map>
 #include <vector>
+#include <memory>
 
 #include "token.hpp"
+#include "tokenize.hpp"
+#include "file_cache.hpp"
+#include "source.hpp"
+#include "pp_hideset.hpp"
+#include "pp_input.hpp"
+#include "pp_macro_table.hpp"
+#include "pp_output.hpp"
+#include "small_vector.hpp"
 
 
 namespace cppi {
 
+struct pp_stats {
+    size_t include_count = 0;
+    size_t include_cache_hits = 0; // file was already loaded and tokenized
+    size_t include_guard_skips = 0; // guard macro still defined, file not entered
+    size_t pragma_once_skips = 0;
+    size_t skipped_groups = 0; // disabled groups jumped over through the directive index
+    size_t if_cache_hits = 0; // #if/#elif results reused without evaluating
+    size_t if_cache_misses = 0;
+};
+
 class pp_context {
-    std::vector<char> preprocessed_buffer;
-
-    struct pp_macro {
-        std::string name;
-        bool has_parameter_list = false;
-        bool has_variadic_param = false;
-        std::vector<token> parameters;
-        std::vector<token> replacement_list;
-    };
-    std::map<std::string, pp_macro> macros;
-    std::vector<std::string> expansion_stack; // to track circular expansion
+    pp_output output;
+    bool text_output = false;
+    bool dump_text = false;
+    std::vector<char> preprocessed_text; // only if text_output or dump_text
+    std::vector<std::shared_ptr<const cached_file>> included_files;
+    std::unordered_set<std::string> once_files; // canonical paths of files with #pragma once
+    pp_stats stats;
+
+    pp_macro_table macros;
+    pp_hideset_table hidesets;
+    source_text expansion_text; // spelling of tokens created by # and ##, defined results
+    scoped_source main_source; // buffer passed to preprocess(), macros defined there point into it
+    std::unique_ptr<lexer> main_lexer; // the root frame pulls from it, only as far as the output has got
+    std::string main_path;
+    bool running = false; // between start() and the end of the root file or an error
 
     enum CONDITION_TYPE {
         COND_IF,
@@ -37,30 +63,127 @@ class pp_context {
     bool pp_token_group_enabled = true;
 
     void pp_error(const char* format, ...);
-    bool is_macro_already_expanding(const std::string& name);
-    bool pp_eval_constant_expression(const std::vector<token>& tokens, int& out);
-    std::vector<char> pp_string_constant_from_tokens(const std::vector<token>& tokens);
-    std::vector<char> pp_string_from_tokens(const std::vector<token>& tokens);
-    bool process_replacement_list(
+    std::vector<pp_token> expression_tokens; // reused by every #if
+
+    // #if/#elif results by hash of the expression spelling
+    // Valid until one of the names looked up while evaluating it is defined or undefined
+    // Only within one top-level preprocess(), it is emptied at the start of the next
+    struct pp_if_cache_entry {
+        std::string expression; // spelling, hash collisions are treated as misses
+        std::vector<std::pair<atom_t, uint32_t>> dependencies; // name and its generation
+        bool result;
+    };
+    std::unordered_map<uint64_t, pp_if_cache_entry> if_cache;
+    std::vector<atom_t>* macro_lookups = 0; // set while an #if is evaluated
+
+    const pp_macro* find_macro(atom_t name);
+    bool pp_expand_and_evaluate(const std::vector<token>& tokens, bool& out);
+    bool pp_eval_constant_expression(const std::vector<token>& tokens, bool& out);
+
+    // pp_expand.cpp
+    // Macro argument, range of arg_tokens or of a pre-expansion buffer
+    struct pp_arg {
+        uint32_t begin = 0;
+        uint32_t end = 0;
+        bool empty() const { return begin == end; }
+    };
+    typedef small_vector<pp_arg, 8> pp_arg_list;
+    // Arguments of the invocations being expanded, used as a stack
+    // An invocation appends its arguments and truncates back to where it started once substituted
+    std::vector<pp_token> arg_tokens;
+    // Scratch buffers for one level of nested expansion, reused by every invocation at that level
+    struct pp_expansion_buffers {
+        std::vector<pp_token> expanded_args; // pre-expanded arguments
+        std::vector<pp_token> replacement;
+    };
+    std::deque<pp_expansion_buffers> expansion_buffers;
+    size_t expansion_depth = 0; // of arguments being pre-expanded
+
+    pp_expansion_buffers& get_expansion_buffers() {
+        if(expansion_depth == expansion_buffers.size()) {
+            expansion_buffers.emplace_back();
+        }
+        return expansion_buffers[expansion_depth];
+    }
+
+    bool collect_macro_args(
+        pp_input& in,
         const pp_macro& macro,
-        std::vector<char>& out,
-        const std::vector<std::vector<token>>& macro_args = std::vector<std::vector<token>>(),
-        const std::vector<token>& va_args = std::vector<token>()
+        pp_arg_list& args,
+        size_t& arg_count,
+        uint32_t& rparen_hideset
     );
-    bool preprocess(
-        const std::vector<token>& tokens, 
-        std::vector<char>& out_buf,
-        const std::string& full_fpath = "", 
-        bool constant_expression = false, 
-        bool include_line = false
+    pp_token stringify(const pp_token* begin, const pp_token* end, const token& hash_tok);
+    bool paste(pp_token& lhs, const pp_token& rhs);
+    bool substitute(
+        const pp_macro& macro,
+        const pp_arg_list& args,
+        uint32_t hideset,
+        std::vector<pp_token>& out
     );
+    // Replaces the invocation at the front of in with its expansion, to be rescanned
+    // expanded stays false if a function-like macro name is not followed by an argument list
+    bool expand_macro(pp_input& in, const pp_macro& macro, bool& expanded);
+    bool expand_tokens(const pp_token* begin, const pp_token* end, std::vector<pp_token>& out);
+    // Macro-expands a directive line, spacing is kept as flags like in the main output
+    bool expand_line(const std::vector<token>& tokens, pp_output& out);
+
+    // File being preprocessed, #include pushes one and reaching its end pops it
+    // Entries past frame_count are kept so their storage is reused by the next include
+    struct pp_frame {
+        const directive_index* directives = 0;
+        pp_input input;
+        std::string full_file_path;
+        std::string include_name; // as written in the #include, empty for the root file
+        bool fresh_line = true;
+        size_t directive_pos = 0; // '#' of the directive being processed
+    };
+    std::vector<pp_frame> frames;
+    size_t frame_count = 0;
+    size_t max_include_depth = 256;
+
+    // Of the innermost frame, kept between pull() calls
+    enum pp_directive_state {
+        PP_DEFAULT, PP_DIRECTIVE,
+        PP_INCLUDE, PP_DEFINE, PP_UNDEF, PP_LINE, PP_ERROR, PP_PRAGMA,
+        PP_IF, PP_IFDEF, PP_IFNDEF, PP_ELIF, PP_ELSE, PP_ENDIF
+    } pp_state = PP_DEFAULT;
+
+    // The caller points the input of the frame at its tokens
+    pp_frame& push_frame(const std::string& full_fpath, const directive_index* directives);
+    // Runs every file from the root down through its includes in one loop,
+    // until the output has count tokens or the root file is done
+    bool run(size_t count);
+    void finish();
 
 public:
     bool preprocess(const char* buffer, size_t length, const char* full_file_path_hint = 0);
 
+    // Same as preprocess(), in steps, so the output can be read while it is produced
+    // start(), then pull() until done(), get_tokens() has what is there so far
+    bool start(const char* buffer, size_t length, const char* full_file_path_hint = 0);
+    // At least count more tokens, fewer once the root file ends, false on an error, which also ends it
+    bool pull(size_t count);
+    bool done() const { return !running; }
+
+    // Tokens for the parser, ending with tok_eof once done()
+    // They point into the files and expansion text held by this context, valid until the next preprocess()
+    const pp_output& get_tokens() const { return output; }
+
+    // Text of the preprocessed tokens, off by default
+    void set_text_output(bool enabled) { text_output = enabled; }
+    // Writes the text next to the root file as <file>.pp
+    void set_dump_text(bool enabled) { dump_text = enabled; }
+    // Matching brackets of the output tokens, see get_tokens().get_bracket_index()
+    void set_bracket_index(bool enabled) { output.set_index_brackets(enabled); }
     size_t get_preprocessed_length() const;
     const char* get_preprocessed_buffer() const;
 
+    const pp_stats& get_stats() const { return stats; }
+
+    // Deeper #include nesting is an error, the root file is depth 1
+    void set_max_include_depth(size_t depth) { max_include_depth = depth; }
+
 };
 
 } // cppi
@@ -0,0 +1,376 @@
+#include "pp_context.hpp"
+
+#include <assert.h>
+
+#include "tokenize.hpp"
+#include "log_internal.hpp"
+
+
+namespace cppi {
+
+static bool is_whitespace_or_newline(const token& tok) {
+    return tok.type == tok_whitespace || tok.type == tok_newline;
+}
+
+// Recorded in macro_lookups while an #if expression is expanded, for the #if cache
+const pp_macro* pp_context::find_macro(atom_t name) {
+    if(macro_lookups) {
+        macro_lookups->push_back(name);
+    }
+    return macros.find(name);
+}
+
+// M() is one empty argument if the macro has parameters, so it fits one named parameter
+static bool check_macro_arg_count(const pp_macro& macro, size_t arg_count) {
+    size_t param_count = macro.parameters.size();
+    if(arg_count == 0 && param_count > 0) {
+        arg_count = 1;
+    }
+    if(macro.has_variadic_param ? arg_count < param_count : arg_count != param_count) {
+        LOG_ERR(
+            "macro %s requires %s%d arguments, but %d were given",
+            atom_string(macro.name), macro.has_variadic_param ? "at least " : "", (int)param_count, (int)arg_count
+        );
+        return false;
+    }
+    return true;
+}
+
+// in is positioned at the opening parenthesis
+// Variadic arguments, commas included, are collected as the last argument
+// arg_count is the number of arguments as written, 0 for M()
+bool pp_context::collect_macro_args(
+    pp_input& in,
+    const pp_macro& macro,
+    pp_arg_list& args,
+    size_t& arg_count,
+    uint32_t& rparen_hideset
+) {
+    in.advance();
+    args.clear();
+    // Empty argument at the end of the tokens collected so far, which is where the next one starts
+    pp_arg arg;
+    arg.begin = arg.end = (uint32_t)arg_tokens.size();
+    args.push_back(arg);
+    int open_paren_count = 1;
+    size_t comma_count = 0; // at the top level, including the ones kept in the variadic argument
+    bool space = false;
+    while(true) {
+        const token& tok = in.current();
+        if(tok.type == tok_eof) {
+            LOG_ERR("macro invocation missing closing parenthesis (reached eof)");
+            return false;
+        }
+        if(is_whitespace_or_newline(tok)) {
+            space = true;
+            in.advance();
+            continue;
+        }
+        if(tok.type == tok_paren_r && --open_paren_count == 0) {
+            rparen_hideset = in.current_hideset();
+            in.advance();
+            break;
+        }
+        if(tok.type == tok_paren_l) {
+            open_paren_count++;
+        }
+        if(open_paren_count == 1 && tok.type == tok_comma) {
+            ++comma_count;
+        }
+        if(open_paren_count == 1 && tok.type == tok_comma && args.size() - 1 < macro.parameters.size()) {
+            args.push_back(arg);
+            space = false;
+            in.advance();
+            continue;
+        }
+        pp_token t = in.take();
+        // Leading whitespace of an argument is dropped
+        t.space_before = !args.back().empty() && (t.space_before || space);
+        space = false;
+        arg_tokens.push_back(t);
+        args.back().end = arg.begin = arg.end = (uint32_t)arg_tokens.size();
+    }
+    arg_count = (comma_count == 0 && args[0].empty()) ? 0 : comma_count + 1;
+    return true;
+}
+
+pp_token pp_context::stringify(const pp_token* begin, const pp_token* end, const token& hash_tok) {
+    std::string str = "\"";
+    for(const pp_token* it = begin; it != end; ++it) {
+        const token& tok = it->tok;
+        if(it != begin && it->space_before) {
+            str.push_back(' ');
+        }
+        std::string s = tok.get_string();
+        if(tok.type == tok_string_constant || tok.type == tok_char_constant) {
+            for(char c : s) {
+                if(c == '"' || c == '\\') {
+                    str.push_back('\\');
+                }
+                str.push_back(c);
+            }
+        } else {
+            str += s;
+        }
+    }
+    str.push_back('"');
+
+    pp_token t;
+    t.tok = hash_tok;
+    t.tok.type = tok_string_constant;
+    t.tok.length = (uint32_t)str.size();
+    if(!expansion_text.store(str.data(), str.size(), t.tok.file, t.tok.offset)) {
+        t.tok.length = 0;
+    }
+    t.tok.atom = atom_none;
+    return t;
+}
+
+bool pp_context::paste(pp_token& lhs, const pp_token& rhs) {
+    std::string str = lhs.tok.get_string() + rhs.tok.get_string();
+    source_id file;
+    uint32_t offset;
+    if(!expansion_text.store(str.data(), str.size(), file, offset)) {
+        return false;
+    }
+    // Exactly one token followed by eof
+    lexer lex(file, offset, offset + str.size());
+    token result = lex.next();
+    if(result.type == tok_eof || is_whitespace_or_newline(result) || result.length != str.size()
+        || lex.next().type != tok_eof
+    ) {
+        LOG_WARN(
+            "pasting \"%s\" and \"%s\" does not give a valid preprocessing token",
+            lhs.tok.get_string().c_str(), rhs.tok.get_string().c_str()
+        );
+        return false;
+    }
+    lhs.tok.type = result.type;
+    lhs.tok.file = file;
+    lhs.tok.offset = offset;
+    lhs.tok.length = (uint32_t)str.size();
+    lhs.tok.atom = result.atom;
+    lhs.placemarker = false;
+    return true;
+}
+
+bool pp_context::substitute(
+    const pp_macro& macro,
+    const pp_arg_list& args,
+    uint32_t hideset,
+    std::vector<pp_token>& out
+) {
+    auto get_arg = [&args](uint32_t slot)->pp_arg{
+        return slot < args.size() ? args[slot] : pp_arg();
+    };
+    // Arguments are fully expanded only if they are used outside of # and ##, and only once
+    // Expanding them can nest another invocation, which uses the buffers of the next level
+    std::vector<pp_token>& expanded = get_expansion_buffers().expanded_args;
+    expanded.clear();
+    pp_arg not_expanded;
+    not_expanded.begin = not_expanded.end = UINT32_MAX;
+    pp_arg_list expanded_args;
+    expanded_args.resize(args.size(), not_expanded);
+    auto append = [&out](const pp_token* begin, const pp_token* end, bool space_before) {
+        size_t first = out.size();
+        out.insert(out.end(), begin, end);
+        if(first < out.size()) {
+            out[first].space_before = space_before;
+        }
+    };
+
+    bool paste_pending = false;
+    for(const pp_macro_instr& instr : macro.code) {
+        if(instr.op == MACRO_OP_PASTE) {
+            paste_pending = !out.empty();
+            continue;
+        }
+        size_t first = out.size();
+        switch(instr.op) {
+        case MACRO_OP_TOKENS:
+            out.insert(out.end(), macro.tokens.begin() + instr.index, macro.tokens.begin() + instr.index + instr.count);
+            break;
+        case MACRO_OP_PARAM:
+            if(instr.index < args.size()) {
+                pp_arg& exp = expanded_args[instr.index];
+                if(exp.begin == UINT32_MAX) {
+                    const pp_arg& arg = args[instr.index];
+                    exp.begin = (uint32_t)expanded.size();
+                    ++expansion_depth;
+                    bool ok = expand_tokens(arg_tokens.data() + arg.begin, arg_tokens.data() + arg.end, expanded);
+                    --expansion_depth;
+                    if(!ok) {
+                        return false;
+                    }
+                    exp.end = (uint32_t)expanded.size();
+                }
+                append(expanded.data() + exp.begin, expanded.data() + exp.end, instr.space_before);
+            }
+            break;
+        case MACRO_OP_PARAM_RAW: {
+            pp_arg arg = get_arg(instr.index);
+            if(arg.empty()) {
+                pp_token placemarker;
+                placemarker.placemarker = true;
+                placemarker.space_before = instr.space_before;
+                out.push_back(placemarker);
+            } else {
+                append(arg_tokens.data() + arg.begin, arg_tokens.data() + arg.end, instr.space_before);
+            }
+            break;
+        }
+        case MACRO_OP_STRINGIFY: {
+            pp_arg arg = get_arg(instr.index);
+            pp_token str = stringify(arg_tokens.data() + arg.begin, arg_tokens.data() + arg.end, macro.tokens[instr.count].tok);
+            str.space_before = instr.space_before;
+            out.push_back(str);
+            break;
+        }
+        case MACRO_OP_COMMA_VA_ARGS: {
+            pp_arg arg = get_arg(instr.index);
+            if(!arg.empty()) {
+                out.push_back(macro.tokens[instr.count]);
+                out.insert(out.end(), arg_tokens.data() + arg.begin, arg_tokens.data() + arg.end);
+            }
+            break;
+        }
+        default:
+            assert(false);
+            break;
+        }
+
+        if(!paste_pending) {
+            continue;
+        }
+        paste_pending = false;
+        if(first == out.size()) {
+            continue;
+        }
+        pp_token& lhs = out[first - 1];
+        if(out[first].placemarker) {
+            out.erase(out.begin() + first);
+        } else if(lhs.placemarker) {
+            out[first].space_before = lhs.space_before;
+            out.erase(out.begin() + first - 1);
+        } else if(paste(lhs, out[first])) {
+            out.erase(out.begin() + first);
+        }
+    }
+
+    size_t n = 0;
+    for(size_t i = 0; i < out.size(); ++i) {
+        if(out[i].placemarker) {
+            continue;
+        }
+        out[n] = out[i];
+        out[n].hideset = hidesets.unite(out[n].hideset, hideset);
+        ++n;
+    }
+    out.resize(n);
+    return true;
+}
+
+bool pp_context::expand_macro(pp_input& in, const pp_macro& macro, bool& expanded) {
+    expanded = false;
+    if(macro.has_parameter_list) {
+        size_t i = 1;
+        while(is_whitespace_or_newline(in.peek(i))) {
+            ++i;
+        }
+        if(in.peek(i).type != tok_paren_l) {
+            return true;
+        }
+    }
+
+    pp_token name = in.take();
+    pp_arg_list args;
+    size_t arg_mark = arg_tokens.size();
+    uint32_t hideset;
+    if(macro.has_parameter_list) {
+        while(is_whitespace_or_newline(in.current())) {
+            in.advance();
+        }
+        size_t arg_count = 0;
+        uint32_t rparen_hideset = 0;
+        if(!collect_macro_args(in, macro, args, arg_count, rparen_hideset)) {
+            arg_tokens.resize(arg_mark);
+            return false;
+        }
+        if(!check_macro_arg_count(macro, arg_count)) {
+            // The invocation is dropped and preprocessing goes on after it
+            arg_tokens.resize(arg_mark);
+            expanded = true;
+            return true;
+        }
+        hideset = hidesets.add(hidesets.intersect(name.hideset, rparen_hideset), macro.name);
+    } else {
+        hideset = hidesets.add(name.hideset, macro.name);
+    }
+
+    std::vector<pp_token>& replacement = get_expansion_buffers().replacement;
+    replacement.clear();
+    bool ok = substitute(macro, args, hideset, replacement);
+    arg_tokens.resize(arg_mark);
+    if(!ok) {
+        return false;
+    }
+    if(!replacement.empty()) {
+        replacement[0].space_before = name.space_before;
+    }
+    in.push_front(replacement);
+    expanded = true;
+    return true;
+}
+
+bool pp_context::expand_tokens(const pp_token* begin, const pp_token* end, std::vector<pp_token>& out) {
+    pp_input in(0, 0);
+    in.push_front(begin, end);
+    while(in.current().type != tok_eof) {
+        const token& tok = in.current();
+        if(tok.type == tok_identifier) {
+            const pp_macro* macro = find_macro(tok.atom);
+            if(macro && !hidesets.contains(in.current_hideset(), tok.atom)) {
+                bool expanded = false;
+                if(!expand_macro(in, *macro, expanded)) {
+                    return false;
+                }
+                if(expanded) {
+                    continue;
+                }
+            }
+        }
+        out.push_back(in.take());
+    }
+    return true;
+}
+
+bool pp_context::expand_line(const std::vector<token>& tokens, pp_output& out) {
+    pp_input in(tokens.data(), tokens.size());
+    while(in.current().type != tok_eof) {
+        const token& tok = in.current();
+        if(is_whitespace_or_newline(tok)) {
+            out.space();
+            in.advance();
+            continue;
+        }
+        if(tok.type == tok_identifier) {
+            const pp_macro* macro = find_macro(tok.atom);
+            if(macro && !hidesets.contains(in.current_hideset(), tok.atom)) {
+                bool expanded = false;
+                if(!expand_macro(in, *macro, expanded)) {
+                    return false;
+                }
+                if(expanded) {
+                    continue;
+                }
+            }
+        }
+        if(in.is_rescanned() && in.current_space_before()) {
+            out.space();
+        }
+        out.emit(in.take().tok);
+    }
+    return true;
+}
+
+} // cppi
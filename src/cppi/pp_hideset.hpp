@@ -0,0 +1,88 @@
+#ifndef CPPI_PP_HIDESET_HPP
+#define CPPI_PP_HIDESET_HPP
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include "intern.hpp"
+
+
+namespace cppi {
+
+// Sets of macro names a token must not be expanded by (Prosser's hide sets)
+// Sets are interned, a token only carries a 32-bit id, 0 is the empty set
+class pp_hideset_table {
+    std::vector<std::vector<atom_t>> sets; // sorted
+    std::map<std::vector<atom_t>, uint32_t> set_ids;
+    std::unordered_map<uint64_t, uint32_t> add_cache;
+
+    uint32_t get_id(const std::vector<atom_t>& set) {
+        auto it = set_ids.find(set);
+        if(it != set_ids.end()) {
+            return it->second;
+        }
+        uint32_t id = (uint32_t)sets.size();
+        sets.push_back(set);
+        set_ids[set] = id;
+        return id;
+    }
+public:
+    pp_hideset_table() {
+        clear();
+    }
+    void clear() {
+        sets.clear();
+        set_ids.clear();
+        add_cache.clear();
+        get_id(std::vector<atom_t>());
+    }
+
+    bool contains(uint32_t hs, atom_t name) const {
+        const auto& set = sets[hs];
+        return std::binary_search(set.begin(), set.end(), name);
+    }
+    uint32_t add(uint32_t hs, atom_t name) {
+        uint64_t key = ((uint64_t)hs << 32) | name;
+        auto it = add_cache.find(key);
+        if(it != add_cache.end()) {
+            return it->second;
+        }
+        std::vector<atom_t> set = sets[hs];
+        auto pos = std::lower_bound(set.begin(), set.end(), name);
+        if(pos == set.end() || *pos != name) {
+            set.insert(pos, name);
+        }
+        uint32_t id = get_id(set);
+        add_cache[key] = id;
+        return id;
+    }
+    uint32_t unite(uint32_t a, uint32_t b) {
+        if(a == b || b == 0) return a;
+        if(a == 0) return b;
+        uint32_t hs = a;
+        // Copy, add() can grow sets
+        std::vector<atom_t> names = sets[b];
+        for(auto name : names) {
+            hs = add(hs, name);
+        }
+        return hs;
+    }
+    uint32_t intersect(uint32_t a, uint32_t b) {
+        if(a == b) return a;
+        if(a == 0 || b == 0) return 0;
+        std::vector<atom_t> set;
+        std::set_intersection(
+            sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(),
+            std::back_inserter(set)
+        );
+        return get_id(set);
+    }
+};
+
+} // cppi
+
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef CPPI_PP_INPUT_HPP
+#define CPPI_PP_INPUT_HPP
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include "token.hpp"
+#include "tokenize.hpp"
+
+
+namespace cppi {
+
+// Token produced by macro expansion
+// Whitespace is not kept as separate tokens here, only as a flag on the token that follows it
+struct pp_token {
+    token       tok;
+    uint32_t    hideset = 0;
+    bool        space_before = false;
+    bool        placemarker = false; // empty argument next to ##, dropped after substitution
+};
+
+// Token sequence being preprocessed, with macro expansions waiting to be rescanned in front of it
+// The sequence is an array, or pulled from a lexer only as far as it is looked at
+class pp_input {
+    const token* tokens;
+    size_t count;
+    size_t cur = 0;
+    std::deque<pp_token> pending;
+    token eof_tok;
+
+    // With a lexer, cur is an index into window, the tokens pulled and not dropped yet
+    // Pulled from const accessors too, the window is only a cache of what the lexer returns
+    lexer* source = 0;
+    mutable std::vector<token> window;
+    mutable bool source_done = false;
+    size_t window_base = 0; // position() of window[0]
+    static const size_t PULL_BATCH = 256;
+    static const size_t WINDOW_KEEP = 4096; // consumed tokens dropped at once
+
+    // False if the lexer ends before window[i]
+    bool pull(size_t i) const {
+        while(i >= window.size()) {
+            if(source_done) {
+                return false;
+            }
+            for(size_t n = 0; n < PULL_BATCH; ++n) {
+                token tok = source->next();
+                if(tok.type == tok_eof) {
+                    source_done = true;
+                    break;
+                }
+                window.push_back(tok);
+            }
+        }
+        return true;
+    }
+    // i-th token of the sequence from the current one
+    const token& base(size_t i) const {
+        if(source) {
+            return pull(cur + i) ? window[cur + i] : eof_tok;
+        }
+        if(cur + i >= count || tokens[cur + i].type == tok_eof) {
+            return eof_tok;
+        }
+        return tokens[cur + i];
+    }
+public:
+    pp_input()
+    : pp_input(0, 0) {}
+    pp_input(const token* tokens, size_t count)
+    : tokens(tokens), count(count) {
+        eof_tok.type = tok_eof;
+    }
+
+    // Starts over on another sequence, keeping the storage of the pending queue
+    void reset(const token* new_tokens, size_t new_count) {
+        tokens = new_tokens;
+        count = new_count;
+        cur = 0;
+        pending.clear();
+        source = 0;
+        window.clear();
+        source_done = false;
+        window_base = 0;
+    }
+    // Pulls from source, which has to outlive this or the next reset()
+    void reset(lexer* new_source) {
+        reset(0, 0);
+        source = new_source;
+    }
+
+    bool is_rescanned() const {
+        return !pending.empty();
+    }
+    const token& current() const {
+        return peek(0);
+    }
+    uint32_t current_hideset() const {
+        return pending.empty() ? 0 : pending.front().hideset;
+    }
+    bool current_space_before() const {
+        return pending.empty() ? false : pending.front().space_before;
+    }
+    // i-th token from the current one, whitespace included
+    const token& peek(size_t i) const {
+        if(i < pending.size()) {
+            return pending[i].tok;
+        }
+        return base(i - pending.size());
+    }
+    // Index of the current token in the base sequence, only meaningful if !is_rescanned()
+    size_t position() const {
+        return window_base + cur;
+    }
+    // Only over an array, what a lexer returned is gone
+    void seek(size_t pos) {
+        assert(!source);
+        pending.clear();
+        cur = pos;
+    }
+    void advance() {
+        if(!pending.empty()) {
+            pending.pop_front();
+        } else if(source) {
+            if(pull(cur)) {
+                ++cur;
+            }
+            if(cur >= WINDOW_KEEP) {
+                window.erase(window.begin(), window.begin() + cur);
+                window_base += cur;
+                cur = 0;
+            }
+        } else if(cur < count) {
+            ++cur;
+        }
+    }
+    // Current token as a pp_token, spacing is taken from the whitespace before it
+    pp_token take() {
+        pp_token t;
+        if(!pending.empty()) {
+            t = pending.front();
+        } else {
+            t.tok = current();
+        }
+        advance();
+        return t;
+    }
+    void push_front(const std::vector<pp_token>& toks) {
+        pending.insert(pending.begin(), toks.begin(), toks.end());
+    }
+    void push_front(const pp_token* begin, const pp_token* end) {
+        pending.insert(pending.begin(), begin, end);
+    }
+};
+
+} // cppi
+
+
+#endif
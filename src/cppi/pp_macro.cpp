@@ -0,0 +1,186 @@
+#include "pp_macro.hpp"
+
+#include <string.h>
+
+#include "log_internal.hpp"
+
+
+namespace cppi {
+
+static void hash_bytes(uint64_t& h, const void* data, size_t len) {
+    // FNV-1a
+    const uint8_t* bytes = (const uint8_t*)data;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+}
+template<typename T>
+static void hash_value(uint64_t& h, const T& value) {
+    hash_bytes(h, &value, sizeof(value));
+}
+
+static uint64_t hash_macro(const pp_macro& macro) {
+    uint64_t h = 14695981039346656037ull;
+    hash_value(h, macro.has_parameter_list);
+    hash_value(h, macro.has_variadic_param);
+    for(auto param : macro.parameters) {
+        hash_value(h, param);
+    }
+    for(auto& t : macro.tokens) {
+        hash_value(h, t.tok.type);
+        hash_value(h, t.space_before);
+        hash_bytes(h, t.tok.str(), t.tok.length);
+    }
+    for(auto& instr : macro.code) {
+        hash_value(h, instr.op);
+        hash_value(h, instr.space_before);
+        hash_value(h, instr.index);
+        hash_value(h, instr.count);
+    }
+    return h;
+}
+
+bool compile_macro(
+    arena& mem,
+    pp_macro& macro,
+    const std::vector<atom_t>& parameters,
+    const std::vector<token>& replacement_list
+) {
+    std::vector<pp_token> tokens;
+    std::vector<pp_macro_instr> code;
+
+    // Whitespace only matters as separation between tokens
+    std::vector<pp_token> body;
+    bool space = false;
+    for(auto& tok : replacement_list) {
+        if(tok.type == tok_whitespace || tok.type == tok_newline) {
+            space = true;
+            continue;
+        }
+        pp_token t;
+        t.tok = tok;
+        t.space_before = space;
+        space = false;
+        body.push_back(t);
+    }
+    if(!body.empty() && body.front().tok.type == tok_double_hash) {
+        LOG_ERR("macro replacement list can't start with '##'");
+        return false;
+    }
+    if(!body.empty() && body.back().tok.type == tok_double_hash) {
+        LOG_ERR("macro replacement list can't end with '##'");
+        return false;
+    }
+
+    auto param_slot = [&macro, &parameters](const token& tok)->int {
+        if(!macro.has_parameter_list || tok.type != tok_identifier) {
+            return -1;
+        }
+        for(size_t i = 0; i < parameters.size(); ++i) {
+            if(parameters[i] == tok.atom) {
+                return (int)i;
+            }
+        }
+        if(macro.has_variadic_param && tok.atom == atom_va_args) {
+            return (int)parameters.size();
+        }
+        return -1;
+    };
+    auto is_paste = [&body](size_t i)->bool {
+        return i < body.size() && body[i].tok.type == tok_double_hash;
+    };
+    auto emit = [&code](pp_macro_op op, bool space_before, uint32_t index, uint32_t count) {
+        pp_macro_instr instr;
+        instr.op = op;
+        instr.space_before = space_before;
+        instr.index = index;
+        instr.count = count;
+        code.push_back(instr);
+    };
+
+    for(size_t i = 0; i < body.size(); ++i) {
+        const pp_token& t = body[i];
+        if(macro.has_parameter_list && t.tok.type == tok_hash) {
+            int slot = i + 1 < body.size() ? param_slot(body[i + 1].tok) : -1;
+            if(slot < 0) {
+                LOG_ERR("'#' is not followed by a macro parameter");
+                return false;
+            }
+            // '#' itself is kept for the position of the string literal
+            emit(MACRO_OP_STRINGIFY, t.space_before, (uint32_t)slot, (uint32_t)tokens.size());
+            tokens.push_back(t);
+            ++i;
+            continue;
+        }
+        if(t.tok.type == tok_double_hash) {
+            emit(MACRO_OP_PASTE, t.space_before, 0, 0);
+            continue;
+        }
+        if(macro.has_variadic_param && t.tok.type == tok_comma && !(i > 0 && is_paste(i - 1))
+            && is_paste(i + 1) && i + 2 < body.size()
+            && body[i + 2].tok.type == tok_identifier && body[i + 2].tok.atom == atom_va_args
+        ) {
+            emit(MACRO_OP_COMMA_VA_ARGS, t.space_before, (uint32_t)parameters.size(), (uint32_t)tokens.size());
+            tokens.push_back(t);
+            i += 2;
+            continue;
+        }
+        int slot = param_slot(t.tok);
+        if(slot >= 0) {
+            bool paste_operand = (i > 0 && is_paste(i - 1)) || is_paste(i + 1);
+            emit(paste_operand ? MACRO_OP_PARAM_RAW : MACRO_OP_PARAM, t.space_before, (uint32_t)slot, 0);
+            continue;
+        }
+        if(!code.empty() && code.back().op == MACRO_OP_TOKENS) {
+            code.back().count++;
+        } else {
+            emit(MACRO_OP_TOKENS, t.space_before, (uint32_t)tokens.size(), 1);
+        }
+        tokens.push_back(t);
+    }
+
+    macro.parameters = mem.copy(parameters);
+    macro.tokens = mem.copy(tokens);
+    macro.code = mem.copy(code);
+    macro.hash = hash_macro(macro);
+    return true;
+}
+
+bool is_same_macro_definition(const pp_macro& a, const pp_macro& b) {
+    if(a.hash != b.hash) {
+        return false;
+    }
+    if(a.has_parameter_list != b.has_parameter_list
+        || a.has_variadic_param != b.has_variadic_param
+        || a.parameters.size() != b.parameters.size()
+        || a.tokens.size() != b.tokens.size()
+        || a.code.size() != b.code.size()
+    ) {
+        return false;
+    }
+    for(size_t i = 0; i < a.parameters.size(); ++i) {
+        if(a.parameters[i] != b.parameters[i]) {
+            return false;
+        }
+    }
+    for(size_t i = 0; i < a.tokens.size(); ++i) {
+        const pp_token& ta = a.tokens[i];
+        const pp_token& tb = b.tokens[i];
+        if(ta.tok.type != tb.tok.type || ta.space_before != tb.space_before || ta.tok.length != tb.tok.length
+            || memcmp(ta.tok.str(), tb.tok.str(), ta.tok.length) != 0
+        ) {
+            return false;
+        }
+    }
+    for(size_t i = 0; i < a.code.size(); ++i) {
+        const pp_macro_instr& ia = a.code[i];
+        const pp_macro_instr& ib = b.code[i];
+        if(ia.op != ib.op || ia.space_before != ib.space_before || ia.index != ib.index || ia.count != ib.count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // cppi
@@ -0,0 +1,57 @@
+#ifndef CPPI_PP_MACRO_HPP
+#define CPPI_PP_MACRO_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "token.hpp"
+#include "intern.hpp"
+#include "pp_input.hpp"
+#include "arena.hpp"
+
+
+namespace cppi {
+
+enum pp_macro_op : uint8_t {
+    MACRO_OP_TOKENS,        // run of replacement list tokens, copied as is
+    MACRO_OP_PARAM,         // fully macro-expanded argument
+    MACRO_OP_PARAM_RAW,     // argument as written, operand of ##, placemarker if empty
+    MACRO_OP_STRINGIFY,     // # param
+    MACRO_OP_PASTE,         // ## between the results of the instructions around it
+    MACRO_OP_COMMA_VA_ARGS  // GNU ', ## __VA_ARGS__', comma dropped if there are no variadic arguments
+};
+
+struct pp_macro_instr {
+    pp_macro_op op;
+    bool        space_before;
+    uint32_t    index;  // first token for MACRO_OP_TOKENS, parameter slot otherwise
+    uint32_t    count;  // MACRO_OP_TOKENS only
+};
+
+// Macro definition compiled once at #define, arrays are stored in the macro table arena
+// Parameter slots are resolved up front, __VA_ARGS__ is the slot after the named parameters
+struct pp_macro {
+    atom_t name = atom_none;
+    bool has_parameter_list = false;
+    bool has_variadic_param = false;
+    arena_span<atom_t> parameters;
+    arena_span<pp_token> tokens; // replacement list without whitespace, spacing kept as a flag
+    arena_span<pp_macro_instr> code;
+    uint64_t hash = 0; // of everything above except the name, to check redefinitions
+};
+
+// replacement_list is the raw token sequence after the macro name or parameter list
+// name, has_parameter_list and has_variadic_param must already be set
+bool compile_macro(
+    arena& mem,
+    pp_macro& macro,
+    const std::vector<atom_t>& parameters,
+    const std::vector<token>& replacement_list
+);
+// Redefinition without a diagnostic is allowed only if this is true
+bool is_same_macro_definition(const pp_macro& a, const pp_macro& b);
+
+} // cppi
+
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef CPPI_PP_MACRO_TABLE_HPP
+#define CPPI_PP_MACRO_TABLE_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "intern.hpp"
+#include "arena.hpp"
+#include "pp_macro.hpp"
+
+
+namespace cppi {
+
+// Defined macros, open addressing with linear probing keyed by atom
+// Macros and their compiled bodies live in the table's arena, #undef only unlinks them
+class pp_macro_table {
+    std::vector<pp_macro*> slots; // null is empty
+    size_t count = 0;
+    arena mem;
+    // By atom, bumped on every #define and #undef of the name, 0 if it was never touched
+    // Also covers names that are not defined, so results that depend on a name being undefined can be cached
+    std::vector<uint32_t> generations;
+    uint32_t last_generation = 0;
+
+    void touch(atom_t name) {
+        if(name >= generations.size()) {
+            generations.resize(name + 1, 0);
+        }
+        generations[name] = ++last_generation;
+    }
+
+    static size_t hash_atom(atom_t name) {
+        // Atoms are dense, spread them over the table
+        return (size_t)(name * 2654435761u);
+    }
+    // Slot holding name, or the empty slot where it would go
+    size_t probe(atom_t name) const {
+        size_t mask = slots.size() - 1;
+        size_t i = hash_atom(name) & mask;
+        while(slots[i] && slots[i]->name != name) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+    void grow() {
+        std::vector<pp_macro*> old_slots(slots.size() * 2, nullptr);
+        old_slots.swap(slots);
+        for(auto m : old_slots) {
+            if(m) {
+                slots[probe(m->name)] = m;
+            }
+        }
+    }
+public:
+    pp_macro_table() {
+        slots.resize(1024, nullptr);
+    }
+
+    // Bodies for compile_macro() are allocated here
+    arena& get_arena() { return mem; }
+
+    size_t size() const { return count; }
+
+    const pp_macro* find(atom_t name) const {
+        return slots[probe(name)];
+    }
+    const pp_macro* find(const char* str, size_t len) const {
+        // A name that was never interned can't be defined
+        atom_t name = find_atom(str, len);
+        if(name == atom_none) {
+            return nullptr;
+        }
+        return find(name);
+    }
+    bool is_defined(atom_t name) const {
+        return find(name) != nullptr;
+    }
+    uint32_t generation(atom_t name) const {
+        return name < generations.size() ? generations[name] : 0;
+    }
+
+    // Replaces an existing definition with the same name
+    void define(const pp_macro& macro) {
+        size_t i = probe(macro.name);
+        pp_macro* m = (pp_macro*)mem.alloc(sizeof(pp_macro), alignof(pp_macro));
+        *m = macro;
+        if(!slots[i]) {
+            ++count;
+        }
+        slots[i] = m;
+        touch(macro.name);
+        if(count * 2 > slots.size()) {
+            grow();
+        }
+    }
+    bool undef(atom_t name) {
+        size_t mask = slots.size() - 1;
+        size_t i = probe(name);
+        if(!slots[i]) {
+            return false;
+        }
+        slots[i] = nullptr;
+        --count;
+        touch(name);
+        // Backward shift, so probe sequences stay unbroken without tombstones
+        size_t j = i;
+        while(true) {
+            j = (j + 1) & mask;
+            if(!slots[j]) {
+                break;
+            }
+            size_t home = hash_atom(slots[j]->name) & mask;
+            bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+            if(movable) {
+                slots[i] = slots[j];
+                slots[j] = nullptr;
+                i = j;
+            }
+        }
+        return true;
+    }
+    void clear() {
+        std::fill(slots.begin(), slots.end(), nullptr);
+        count = 0;
+        std::fill(generations.begin(), generations.end(), ++last_generation);
+        mem.clear();
+    }
+};
+
+} // cppi
+
+
+#endif
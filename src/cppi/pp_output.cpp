@@ -0,0 +1,49 @@
+#include "pp_output.hpp"
+
+#include <string.h>
+#include <string>
+
+#include "char_class.hpp"
+
+
+namespace cppi {
+
+// Would the two characters read as part of one token if written next to each other
+static bool chars_would_paste(char a, char b) {
+    static const char* punct = "+-*/%<>=!&|^:.#";
+    if(is_ident_char(a) && is_ident_char(b)) {
+        return true;
+    }
+    if((is_digit_char(a) && b == '.') || (a == '.' && is_digit_char(b))) {
+        return true;
+    }
+    return a != '\0' && b != '\0' && strchr(punct, a) && strchr(punct, b);
+}
+
+void write_tokens_text(const pp_output& tokens, std::vector<char>& out) {
+    const token* prev = 0;
+    for(size_t i = 0; i < tokens.size(); ++i) {
+        const token& tok = tokens[i];
+        if(tok.type == tok_eof) {
+            break;
+        }
+        if(prev) {
+            // Tokens that were next to each other in the same source were already lexed apart
+            bool adjacent = prev->file == tok.file && prev->offset + prev->length == tok.offset;
+            if(tok.flags & tok_flag_line_start) {
+                out.push_back('\n');
+            } else if(tok.flags & tok_flag_space_before) {
+                out.push_back(' ');
+            } else if(!adjacent && prev->length > 0 && tok.length > 0
+                && chars_would_paste(prev->str()[prev->length - 1], tok.str()[0])
+            ) {
+                out.push_back(' ');
+            }
+        }
+        std::string str = tok.get_string();
+        out.insert(out.end(), str.begin(), str.end());
+        prev = &tok;
+    }
+}
+
+} // cppi
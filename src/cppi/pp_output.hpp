@@ -0,0 +1,174 @@
+#ifndef CPPI_PP_OUTPUT_HPP
+#define CPPI_PP_OUTPUT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "token.hpp"
+#include "keywords.hpp"
+
+
+namespace cppi {
+
+// Matching bracket of every {}, [] and () token of the output, so a whole group can be skipped with one read
+// Built in the same pass that emits the tokens, with a stack of the brackets still open
+class bracket_index {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+private:
+    struct open_bracket {
+        uint32_t pos;
+        token_type closer;
+    };
+    std::vector<uint32_t> match; // closer of an opener, opener of a closer, NONE for other tokens
+    std::vector<open_bracket> open; // innermost last, after finish() the ones never closed
+    uint32_t error_pos = NONE; // closer that matches no opener, tokens from it on are not indexed
+    uint32_t limit_pos = 0;
+
+public:
+    void clear() {
+        match.clear();
+        open.clear();
+        error_pos = NONE;
+        limit_pos = 0;
+    }
+    // pos is the index of the token in the output, tokens are added in order
+    void add(token_type type, uint32_t pos) {
+        match.push_back((uint32_t)NONE); // by value, NONE has no out of line definition
+        if(error_pos != NONE) {
+            return;
+        }
+        open_bracket b;
+        switch(type) {
+        case tok_brace_l: b.closer = tok_brace_r; break;
+        case tok_bracket_l: b.closer = tok_bracket_r; break;
+        case tok_paren_l: b.closer = tok_paren_r; break;
+        case tok_brace_r:
+        case tok_bracket_r:
+        case tok_paren_r:
+            if(open.empty() || open.back().closer != type) {
+                error_pos = pos;
+                return;
+            }
+            match[pos] = open.back().pos;
+            match[open.back().pos] = pos;
+            open.pop_back();
+            return;
+        default:
+            return;
+        }
+        b.pos = pos;
+        open.push_back(b);
+    }
+    // end_pos is the index of the final eof token
+    // Brackets left open extend to the end of the indexed tokens, as if closed right there
+    void finish(uint32_t end_pos) {
+        limit_pos = error_pos != NONE ? error_pos : end_pos;
+        for(auto& b : open) {
+            match[b.pos] = limit_pos;
+        }
+    }
+
+    uint32_t match_of(uint32_t pos) const { return match[pos]; }
+    // Tokens before this are indexed, either the eof or the mismatched closer
+    uint32_t limit() const { return limit_pos; }
+    uint32_t error() const { return error_pos; }
+    bool has_unclosed() const { return !open.empty(); }
+    uint32_t last_unclosed() const { return open.back().pos; }
+    // Outermost bracket left open at or after pos, NONE if there is none
+    uint32_t unclosed_from(uint32_t pos) const {
+        for(auto& b : open) {
+            if(b.pos >= pos) {
+                return b.pos;
+            }
+        }
+        return NONE;
+    }
+};
+
+// Preprocessed tokens, as the parser reads them
+// Whitespace and newlines are not kept as tokens, only as flags on the token that follows them
+// Every file and include level appends to the same output, tokens are stored in fixed size chunks
+// that never move, so nothing is copied again as it grows
+class pp_output {
+public:
+    static const size_t CHUNK_SHIFT = 12;
+    static const size_t CHUNK_SIZE = (size_t)1 << CHUNK_SHIFT; // tokens, 64KB
+
+private:
+    std::vector<std::unique_ptr<token[]>> chunks;
+    size_t count = 0;
+    uint8_t pending_flags = tok_flag_line_start;
+    bool index_brackets = false;
+    bracket_index brackets;
+
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const token& operator[](size_t i) const {
+        return chunks[i >> CHUNK_SHIFT][i & (CHUNK_SIZE - 1)];
+    }
+    const token& back() const { return (*this)[count - 1]; }
+
+    // Chunks are kept for the next run
+    void clear() {
+        count = 0;
+        pending_flags = tok_flag_line_start;
+        brackets.clear();
+    }
+
+    // Off by default, set before anything is emitted
+    void set_index_brackets(bool enabled) { index_brackets = enabled; }
+    bool has_bracket_index() const { return index_brackets; }
+    // Complete once the final eof is pushed
+    const bracket_index& get_bracket_index() const { return brackets; }
+
+    void space() {
+        pending_flags |= tok_flag_space_before;
+    }
+    void newline() {
+        pending_flags |= tok_flag_line_start;
+    }
+    // Stored as is, without keyword lookup or pending flags
+    void push_back(const token& tok) {
+        size_t chunk = count >> CHUNK_SHIFT;
+        if(chunk == chunks.size()) {
+            chunks.emplace_back(new token[CHUNK_SIZE]);
+        }
+        chunks[chunk][count & (CHUNK_SIZE - 1)] = tok;
+        ++count;
+    }
+    void emit(token tok) {
+        // Keywords are plain identifiers while preprocessing
+        if(tok.type == tok_identifier) {
+            tok.type = keyword_lookup(tok.str(), tok.length);
+        }
+        tok.flags = pending_flags;
+        pending_flags = 0;
+        if(index_brackets) {
+            brackets.add(tok.type, (uint32_t)count);
+        }
+        push_back(tok);
+    }
+    // Ends the output, nothing can be emitted after it
+    void push_eof() {
+        token eof;
+        eof.type = tok_eof;
+        if(index_brackets) {
+            brackets.add(tok_eof, (uint32_t)count);
+            brackets.finish((uint32_t)count);
+        }
+        push_back(eof);
+    }
+};
+
+// Text that reads back as the same tokens, only for debugging and #include names
+void write_tokens_text(const pp_output& tokens, std::vector<char>& out);
+
+} // cppi
+
+
+#endif
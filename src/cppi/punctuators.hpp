@@ -0,0 +1,100 @@
+#ifndef CPPI_PUNCTUATORS_HPP
+#define CPPI_PUNCTUATORS_HPP
+
+#include <stdint.h>
+#include "token.hpp"
+#include "char_class.hpp"
+
+
+struct punctuator_entry {
+    const char* text;
+    token_type  type;
+};
+
+// Punctuators starting with a cc_punct character
+// Every prefix of one is a punctuator too, so the longest match never has to back up
+constexpr punctuator_entry punctuator_entries[] = {
+    { ";",   tok_semicolon },
+    { "{",   tok_brace_l },
+    { "}",   tok_brace_r },
+    { "[",   tok_bracket_l },
+    { "]",   tok_bracket_r },
+    { "(",   tok_paren_l },
+    { ")",   tok_paren_r },
+    { "#",   tok_hash },
+    { "##",  tok_double_hash },
+    { "=",   tok_assign },
+    { "==",  tok_equals },
+    { "+",   tok_plus },
+    { "++",  tok_incr },
+    { "+=",  tok_plus_assign },
+    { "-",   tok_minus },
+    { "--",  tok_decr },
+    { "-=",  tok_minus_assign },
+    { "->",  tok_arrow },
+    { "->*", tok_arrow_member },
+    { "*",   tok_asterisk },
+    { "*=",  tok_asterisk_assign },
+    { "%",   tok_percent },
+    { "%=",  tok_percent_assign },
+    { "!",   tok_excl },
+    { "!=",  tok_excl_assign },
+    { "<",   tok_less },
+    { "<=",  tok_less_assign },
+    { "<=>", tok_three_way_comp },
+    { "<<",  tok_shift_left },
+    { "<<=", tok_shift_left_assign },
+    { ">",   tok_more },
+    { ">=",  tok_more_assign },
+    { ">>",  tok_shift_right },
+    { ">>=", tok_shift_right_assign },
+    { "&",   tok_amp },
+    { "&&",  tok_double_amp },
+    { "&=",  tok_amp_assign },
+    { "|",   tok_pipe },
+    { "||",  tok_double_pipe },
+    { "|=",  tok_pipe_assign },
+    { "~",   tok_tilde },
+    { "^",   tok_hat },
+    { "^=",  tok_hat_assign },
+    { ",",   tok_comma },
+    { "?",   tok_question },
+    { ":",   tok_colon },
+    { "::",  tok_double_colon }
+};
+
+// Trie over punctuator_entries, state 0 is the start and means no transition
+struct punctuator_table {
+    static const int MAX_STATES = 64;
+    static const int MAX_CHARS = 32;
+
+    uint8_t     char_index[256]; // column in next, 0 for characters that don't appear in punctuators
+    uint8_t     next[MAX_STATES][MAX_CHARS];
+    token_type  type[MAX_STATES];
+};
+
+constexpr punctuator_table make_punctuator_table() {
+    punctuator_table t = {};
+    int char_count = 1;
+    int state_count = 1;
+    for(const punctuator_entry& e : punctuator_entries) {
+        int state = 0;
+        for(const char* p = e.text; *p; ++p) {
+            uint8_t c = (uint8_t)*p;
+            if(t.char_index[c] == 0) {
+                t.char_index[c] = (uint8_t)char_count++;
+            }
+            if(t.next[state][t.char_index[c]] == 0) {
+                t.next[state][t.char_index[c]] = (uint8_t)state_count++;
+            }
+            state = t.next[state][t.char_index[c]];
+        }
+        t.type[state] = e.type;
+    }
+    return t;
+}
+
+constexpr punctuator_table punctuators = make_punctuator_table();
+
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CPPI_SIMD_HPP
+#define CPPI_SIMD_HPP
+
+#include <stdint.h>
+
+// SSE2 is part of x64, so it needs no runtime check
+// AVX2 code is compiled in as well, but only run if cpu_has_avx2()
+#if defined(_M_X64) || defined(__SSE2__)
+#define CPPI_SSE2
+#define CPPI_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CPPI_TARGET_AVX2
+#else
+#define CPPI_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+namespace cppi {
+
+// Index of the lowest set bit, mask must not be 0
+inline unsigned lowest_bit_index(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+inline bool cpu_has_avx2() {
+#if !defined(CPPI_AVX2)
+    return false;
+#elif defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if(regs[0] < 7) {
+        return false;
+    }
+    // The OS has to save the YMM registers too
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx = (regs[2] & (1 << 28)) != 0;
+    if(!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+} // cppi
+
+
+#endif
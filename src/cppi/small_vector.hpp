@@ -0,0 +1,48 @@
+#ifndef CPPI_SMALL_VECTOR_HPP
+#define CPPI_SMALL_VECTOR_HPP
+
+#include <stddef.h>
+#include <vector>
+
+
+namespace cppi {
+
+// Keeps the first N items inline, for short lists built on hot paths
+// T must be trivially copyable
+template<typename T, size_t N>
+class small_vector {
+    T inline_items[N];
+    std::vector<T> overflow; // items from N on
+    size_t count = 0;
+public:
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) { return i < N ? inline_items[i] : overflow[i - N]; }
+    const T& operator[](size_t i) const { return i < N ? inline_items[i] : overflow[i - N]; }
+    T& back() { return (*this)[count - 1]; }
+
+    void push_back(const T& item) {
+        if(count < N) {
+            inline_items[count] = item;
+        } else {
+            overflow.push_back(item);
+        }
+        ++count;
+    }
+    void resize(size_t n, const T& item) {
+        while(count < n) {
+            push_back(item);
+        }
+        count = n;
+        overflow.resize(n > N ? n - N : 0);
+    }
+    void clear() {
+        count = 0;
+        overflow.clear();
+    }
+};
+
+} // cppi
+
+
+#endif
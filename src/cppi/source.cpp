@@ -0,0 +1,135 @@
+#include "source.hpp"
+
+#include <assert.h>
+#include <string>
+#include <mutex>
+#include <algorithm>
+
+#include "simd.hpp"
+
+#include "log_internal.hpp"
+
+
+namespace cppi {
+
+const char* source_base[SOURCE_ID_COUNT] = { "" };
+
+// Offset of the first character of every line, 16 bytes compared at a time
+static void build_line_starts(const char* data, size_t size, std::vector<uint32_t>& starts) {
+    starts.clear();
+    starts.push_back(0);
+    size_t i = 0;
+#ifdef CPPI_SSE2
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        while(mask) {
+            starts.push_back((uint32_t)(i + lowest_bit_index(mask) + 1));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for(; i < size; ++i) {
+        if(data[i] == '\n') {
+            starts.push_back((uint32_t)(i + 1));
+        }
+    }
+}
+
+class source_registry {
+    struct entry {
+        size_t      size = 0;
+        std::string name;
+        bool        has_line_starts = false;
+        std::vector<uint32_t> line_starts; // built by the first line_col() lookup
+    };
+
+    std::mutex mtx;
+    std::vector<entry> entries; // by id
+    std::vector<source_id> free_ids;
+public:
+    source_registry() {
+        entries.resize(1);
+    }
+
+    source_id add(const char* data, size_t size, const char* name) {
+        std::lock_guard<std::mutex> lock(mtx);
+        source_id id;
+        if(!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else if(entries.size() < SOURCE_ID_COUNT) {
+            id = (source_id)entries.size();
+            entries.emplace_back();
+        } else {
+            LOG_ERR("all %d source ids are in use, can't add '%s'", (int)SOURCE_ID_COUNT - 1, name);
+            return source_none;
+        }
+        entries[id].size = size;
+        entries[id].name = name;
+        source_base[id] = data;
+        return id;
+    }
+    void release(source_id id) {
+        if(id == source_none) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        assert(id < entries.size());
+        entries[id] = entry();
+        source_base[id] = "";
+        free_ids.push_back(id);
+    }
+    size_t size(source_id id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        assert(id < entries.size());
+        return entries[id].size;
+    }
+    std::string name(source_id id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        assert(id < entries.size());
+        return entries[id].name;
+    }
+    void line_col(source_id id, size_t offset, size_t& line, size_t& col) {
+        std::lock_guard<std::mutex> lock(mtx);
+        assert(id < entries.size());
+        entry& e = entries[id];
+        if(!e.has_line_starts) {
+            build_line_starts(source_base[id], e.size, e.line_starts);
+            e.has_line_starts = true;
+        }
+        if(offset > e.size) {
+            offset = e.size;
+        }
+        // Last line starting at or before offset
+        auto it = std::upper_bound(e.line_starts.begin(), e.line_starts.end(), (uint32_t)offset);
+        size_t index = (it - e.line_starts.begin()) - 1;
+        line = index + 1;
+        col = offset - e.line_starts[index];
+    }
+};
+
+static source_registry& get_registry() {
+    static source_registry registry;
+    return registry;
+}
+
+source_id register_source(const char* data, size_t size, const char* name) {
+    return get_registry().add(data, size, name);
+}
+void release_source(source_id id) {
+    get_registry().release(id);
+}
+size_t source_size(source_id id) {
+    return get_registry().size(id);
+}
+std::string source_name(source_id id) {
+    return get_registry().name(id);
+}
+
+void source_line_col(source_id id, size_t offset, size_t& line, size_t& col) {
+    get_registry().line_col(id, offset, line, col);
+}
+
+} // cppi
@@ -0,0 +1,124 @@
+#ifndef CPPI_SOURCE_HPP
+#define CPPI_SOURCE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+
+namespace cppi {
+
+// Id of a buffer tokens point into, a token keeps the id and an offset instead of a pointer
+typedef uint16_t source_id;
+
+const size_t SOURCE_ID_COUNT = 0x10000;
+// Empty, tokens that were never given any text point here
+const source_id source_none = 0;
+
+// By id, written only while an id is registered, so reads don't need a lock
+extern const char* source_base[SOURCE_ID_COUNT];
+
+// Process-wide, since cached files carry tokens and are shared between contexts
+// data must stay valid and unchanged until the id is released
+// Returns source_none if all SOURCE_ID_COUNT - 1 ids are in use. Ids in use at a time are
+// - one per file_cache entry, the cache holds at most SOURCE_ID_COUNT / 2 of them, fewer by default,
+//   plus evicted entries a pp_context still holds until its next preprocess()
+// - per pp_context, its root file and one per 64KB of text made by macro expansion, released by the next preprocess()
+// Released ids are reused, so a long batch only runs out if that many are needed at the same time
+source_id   register_source(const char* data, size_t size, const char* name);
+void        release_source(source_id id);
+size_t      source_size(source_id id);
+std::string source_name(source_id id);
+
+inline const char* source_data(source_id id) {
+    return source_base[id];
+}
+
+// Line is 1-based and col 0-based
+// The source's line start table is built on the first lookup, after that it's a binary search
+void source_line_col(source_id id, size_t offset, size_t& line, size_t& col);
+
+// Keeps a buffer registered for the lifetime of the object
+class scoped_source {
+    source_id id = source_none;
+public:
+    scoped_source() {}
+    scoped_source(const char* data, size_t size, const char* name) {
+        id = register_source(data, size, name);
+    }
+    scoped_source(const scoped_source&) = delete;
+    scoped_source& operator=(const scoped_source&) = delete;
+    ~scoped_source() {
+        reset();
+    }
+    void reset() {
+        if(id != source_none) {
+            release_source(id);
+            id = source_none;
+        }
+    }
+    void reset(const char* data, size_t size, const char* name) {
+        reset();
+        id = register_source(data, size, name);
+    }
+    source_id get() const { return id; }
+};
+
+// Bump allocator for generated text, every chunk is registered as a source of its own
+class source_text {
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    struct chunk {
+        std::unique_ptr<char[]> data;
+        source_id id;
+    };
+    std::vector<chunk> chunks;
+    size_t chunk_size = 0;
+    size_t chunk_used = 0;
+public:
+    source_text() {}
+    source_text(const source_text&) = delete;
+    source_text& operator=(const source_text&) = delete;
+    ~source_text() {
+        clear();
+    }
+
+    // Null terminated copy of str, returns where it was put
+    bool store(const char* str, size_t len, source_id& id, uint32_t& offset) {
+        if(chunks.empty() || chunk_used + len + 1 > chunk_size) {
+            chunk c;
+            chunk_size = len + 1 > CHUNK_SIZE ? len + 1 : CHUNK_SIZE;
+            c.data.reset(new char[chunk_size]);
+            c.id = register_source(c.data.get(), chunk_size, "<generated>");
+            if(c.id == source_none) {
+                chunk_size = 0;
+                return false;
+            }
+            chunks.push_back(std::move(c));
+            chunk_used = 0;
+        }
+        char* dst = chunks.back().data.get() + chunk_used;
+        memcpy(dst, str, len);
+        dst[len] = '\0';
+        id = chunks.back().id;
+        offset = (uint32_t)chunk_used;
+        chunk_used += len + 1;
+        return true;
+    }
+    void clear() {
+        for(auto& c : chunks) {
+            release_source(c.id);
+        }
+        chunks.clear();
+        chunk_size = 0;
+        chunk_used = 0;
+    }
+};
+
+} // cppi
+
+
+#endif
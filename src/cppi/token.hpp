@@ -4,10 +4,13 @@
 #include <assert.h>
 #include <algorithm>
 #include <string>
+#include <string.h>
+#include <stdint.h>
 
-#include "util.hpp"
+#include "intern.hpp"
+#include "source.hpp"
 
-enum token_type {
+enum token_type : uint8_t {
     tok_error,
     tok_identifier,
     tok_string_literal,
@@ -186,19 +189,53 @@ enum token_type {
 struct token;
 inline bool tok_name_match(const token& tok, const char* name);
 
+// Drop line splices left in place by the tokenizer
+inline std::string remove_splices(const char* string, size_t length) {
+    if(!memchr(string, '\\', length)) {
+        return std::string(string, length);
+    }
+    std::string str;
+    str.reserve(length);
+    for(size_t i = 0; i < length; ++i) {
+        if(string[i] == '\\' && i + 1 < length && string[i + 1] == '\n') {
+            ++i;
+        } else if(string[i] == '\\' && i + 2 < length && string[i + 1] == '\r' && string[i + 2] == '\n') {
+            i += 2;
+        } else {
+            str.push_back(string[i]);
+        }
+    }
+    return str;
+}
+
+// Spacing of preprocessed tokens, which don't have whitespace and newline tokens between them
+enum token_flags : uint8_t {
+    tok_flag_space_before = 1,
+    tok_flag_line_start = 2
+};
+
+// 16 bytes, text is referenced by source id and offset, line and column are worked out on demand
 struct token {
-    token_type  type = tok_error;
-    const char* string;
-    size_t      length;
+    token_type      type = tok_error;
+    uint8_t         flags = 0; // token_flags
+    cppi::source_id file = cppi::source_none;
+    uint32_t        offset = 0;
+    uint32_t        length = 0;
 
-    size_t      line;
-    size_t      col;
+    cppi::atom_t    atom = cppi::atom_none; // identifiers and keywords only
 
+    // Text as written, may contain line splices
+    const char* str() const {
+        return cppi::source_data(file) + offset;
+    }
+    void get_line_col(size_t& line, size_t& col) const {
+        cppi::source_line_col(file, offset, line, col);
+    }
     std::string get_string() const {
         if (type == tok_eof) {
             return "";
         }
-        return std::string(string, length);
+        return remove_splices(str(), length);
     }
     int to_int() const {
         assert(type == tok_int_literal);
@@ -215,7 +252,7 @@ struct token {
     }
     std::string to_string() const {
         assert(type == tok_string_constant);
-        return std::string(string + 1, string + length - 1);
+        return std::string(str() + 1, str() + length - 1);
     }
     bool to_bool() const {
         if(tok_name_match(*this, "true")) {
@@ -228,13 +265,14 @@ struct token {
         }
     }
 };
+static_assert(sizeof(token) == 16, "token must stay 16 bytes");
 
 inline bool tok_name_match(const token& tok, const char* name) {
     size_t len = strlen(name);
     if(tok.length != len) {
         return false;
     }
-    return strncmp(tok.string, name, len) == 0;
+    return strncmp(tok.str(), name, len) == 0;
 }
 
 class token_cursor {
@@ -0,0 +1,306 @@
+#include "tokenize.hpp"
+
+#include <string.h>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+
+typedef std::chrono::steady_clock tokenize_clock;
+
+static double seconds_since(tokenize_clock::time_point start) {
+    return std::chrono::duration<double>(tokenize_clock::now() - start).count();
+}
+
+// Tokens starting in [begin, end), the lexer reads on past end to finish the last one
+struct tokenize_chunk {
+    size_t begin = 0;
+    size_t end = 0;
+    bool in_block_comment = false; // begin is inside a block comment that started in an earlier chunk
+    std::unique_ptr<lexer> lex;
+    std::vector<token> tokens;
+    token next; // first token starting at or after end, tok_eof if there is none
+    cppi::local_interner atoms;
+    std::vector<cppi::atom_t> atom_map; // local atom to process-wide atom
+    double seconds = 0;
+};
+
+// Local atom of a token of chunk to the process-wide one, the lexer of a chunk can go on interning after the merge
+static void to_global_atom(tokenize_chunk& chunk, token& tok) {
+    if(tok.atom == cppi::atom_none) {
+        return;
+    }
+    if(tok.atom >= chunk.atom_map.size()) {
+        chunk.atoms.merge(chunk.atom_map);
+    }
+    tok.atom = chunk.atom_map[tok.atom];
+}
+
+static void lex_chunk(tokenize_chunk& chunk) {
+    tokenize_clock::time_point start = tokenize_clock::now();
+    while(true) {
+        token tok = chunk.lex->next();
+        if(tok.type == tok_eof || tok.offset >= chunk.end) {
+            chunk.next = tok;
+            break;
+        }
+        chunk.tokens.push_back(tok);
+    }
+    // Once per chunk instead of once per identifier
+    chunk.atoms.merge(chunk.atom_map);
+    for(auto& tok : chunk.tokens) {
+        to_global_atom(chunk, tok);
+    }
+    to_global_atom(chunk, chunk.next);
+    chunk.seconds = seconds_since(start);
+}
+
+// Start of the first line at or after pos, not counting newlines that are part of a line splice
+static size_t next_line_start(const char* data, size_t size, size_t pos) {
+    while(pos < size) {
+        const char* nl = (const char*)memchr(data + pos, '\n', size - pos);
+        if(!nl) {
+            return size;
+        }
+        size_t i = nl - data;
+        bool spliced = (i >= 1 && data[i - 1] == '\\') || (i >= 2 && data[i - 2] == '\\' && data[i - 1] == '\r');
+        if(!spliced) {
+            return i + 1;
+        }
+        pos = i + 1;
+    }
+    return size;
+}
+
+static size_t skip_splices(const char* data, size_t size, size_t i) {
+    size_t splice_len;
+    while(i < size && (splice_len = splice_length(data, size, i)) != 0) {
+        i += splice_len;
+    }
+    return i;
+}
+
+// Finds which chunks begin inside a block comment, in one pass over the source that follows the lexer
+// only as far as comments, strings and char constants, everything else can't hide a "/*" or "*/"
+// A string, char constant or line comment ends at the end of its line, so at a line start it's either this or code
+// It stops at the start of the last chunk, or at a '\0', the lexer doesn't get past that anyway
+static void find_block_comment_starts(const char* data, size_t size, std::vector<tokenize_chunk>& chunks) {
+    static const struct stop_table {
+        bool stop[256];
+        stop_table() : stop() {
+            stop[(uint8_t)'/'] = stop[(uint8_t)'\"'] = stop[(uint8_t)'\''] = stop[0] = true;
+        }
+    } code;
+    const cppi::lexer_scanners& scan = cppi::get_lexer_scanners();
+    size_t k = 1;
+    size_t i = 0;
+    while(true) {
+        while(i < size && !code.stop[(uint8_t)data[i]]) {
+            ++i;
+        }
+        if(i >= size || data[i] == '\0') {
+            return;
+        }
+        if(data[i] == '/') {
+            size_t start = i;
+            i = skip_splices(data, size, i + 1);
+            if(i >= size) {
+                return;
+            }
+            if(data[i] == '/') {
+                // Up to the newline, which is lexed as code
+                ++i;
+                while(true) {
+                    i = scan.line_comment(data, i, size);
+                    if(i >= size || data[i] == '\0') {
+                        return;
+                    }
+                    if(data[i] == '\n') {
+                        break;
+                    }
+                    // '\\', after a splice the next line is still comment
+                    size_t after = skip_splices(data, size, i);
+                    i = after == i ? i + 1 : after;
+                }
+            } else if(data[i] == '*') {
+                // The '*' that opened it can't close it
+                ++i;
+                while(true) {
+                    i = scan.block_comment(data, i, size);
+                    if(i < size && data[i] == '\\') {
+                        size_t after = skip_splices(data, size, i);
+                        i = after == i ? i + 1 : after;
+                        continue;
+                    }
+                    if(i >= size || data[i] == '\0') {
+                        // Not closed before the last chunk starts
+                        while(k < chunks.size() && chunks[k].begin <= start) {
+                            ++k;
+                        }
+                        for(; k < chunks.size(); ++k) {
+                            chunks[k].in_block_comment = true;
+                        }
+                        return;
+                    }
+                    i = skip_splices(data, size, i + 1);
+                    if(i < size && data[i] == '/') {
+                        ++i;
+                        break;
+                    }
+                }
+                while(k < chunks.size() && chunks[k].begin <= start) {
+                    ++k;
+                }
+                for(; k < chunks.size() && chunks[k].begin < i; ++k) {
+                    chunks[k].in_block_comment = true;
+                }
+            }
+        } else {
+            // String or char constant, up to the quote or the newline, both part of it
+            char quote = data[i];
+            size_t (*body)(const char*, size_t, size_t) = quote == '\"' ? scan.string_body : scan.char_body;
+            ++i;
+            while(true) {
+                i = body(data, i, size);
+                if(i >= size || data[i] == '\0') {
+                    return;
+                }
+                if(data[i] == '\\') {
+                    size_t after = skip_splices(data, size, i);
+                    if(after != i) {
+                        i = after;
+                        continue;
+                    }
+                    // Escape, the character after it is taken as is
+                    i = skip_splices(data, size, i + 1);
+                    if(i >= size || data[i] == '\0') {
+                        return;
+                    }
+                    ++i;
+                    continue;
+                }
+                ++i;
+                break;
+            }
+        }
+    }
+}
+
+bool tokenize_parallel(
+    cppi::source_id file, std::vector<token>& tokens,
+    bool skip_space_and_newline, bool classify_keywords,
+    unsigned thread_count, tokenize_parallel_stats* stats
+) {
+    size_t size = cppi::source_size(file);
+    if(thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if(stats) {
+        bool serial = stats->serial;
+        *stats = tokenize_parallel_stats();
+        stats->serial = serial;
+    }
+    if(thread_count < 2 || size < PARALLEL_TOKENIZE_MIN_SIZE || size > UINT32_MAX) {
+        return tokenize(file, 0, size, tokens, skip_space_and_newline, classify_keywords);
+    }
+
+    const char* data = cppi::source_data(file);
+    std::vector<size_t> starts;
+    size_t begin = 0;
+    for(unsigned i = 0; i < thread_count && begin < size; ++i) {
+        size_t end = i + 1 == thread_count ? size : next_line_start(data, size, size / thread_count * (i + 1));
+        if(end <= begin) {
+            continue;
+        }
+        starts.push_back(begin);
+        begin = end;
+    }
+    std::vector<tokenize_chunk> chunks(starts.size());
+    for(size_t i = 0; i < chunks.size(); ++i) {
+        chunks[i].begin = starts[i];
+        chunks[i].end = i + 1 < starts.size() ? starts[i + 1] : size;
+    }
+
+    tokenize_clock::time_point start = tokenize_clock::now();
+    find_block_comment_starts(data, chunks.back().begin, chunks);
+    if(stats) {
+        stats->prescan_seconds = seconds_since(start);
+        start = tokenize_clock::now();
+    }
+    for(auto& chunk : chunks) {
+        chunk.lex.reset(new lexer(file, chunk.begin, size, skip_space_and_newline, classify_keywords));
+        chunk.lex->set_local_interner(&chunk.atoms);
+        if(chunk.in_block_comment) {
+            chunk.lex->resume_in_block_comment();
+        }
+    }
+    if(stats && stats->serial) {
+        for(auto& chunk : chunks) {
+            lex_chunk(chunk);
+        }
+    } else {
+        std::vector<std::thread> threads;
+        for(size_t i = 1; i < chunks.size(); ++i) {
+            threads.push_back(std::thread(lex_chunk, std::ref(chunks[i])));
+        }
+        lex_chunk(chunks[0]);
+        for(auto& t : threads) {
+            t.join();
+        }
+    }
+    if(stats) {
+        stats->lex_seconds = seconds_since(start);
+        start = tokenize_clock::now();
+    }
+
+    // A chunk was lexed from the right state if its first token is the one the chunk before it ends on,
+    // the pre-scan makes sure of that, if it isn't the lexer of the chunk before goes on through it
+    size_t count = 0;
+    for(auto& chunk : chunks) {
+        count += chunk.tokens.size();
+    }
+    tokens.reserve(tokens.size() + count + 1);
+    tokens.insert(tokens.end(), chunks[0].tokens.begin(), chunks[0].tokens.end());
+    tokenize_chunk* owner = &chunks[0];
+    token next = chunks[0].next;
+    unsigned relexed = 0;
+    for(size_t i = 1; i < chunks.size() && next.type != tok_eof; ++i) {
+        tokenize_chunk& chunk = chunks[i];
+        const token& first = chunk.tokens.empty() ? chunk.next : chunk.tokens.front();
+        if(first.type == next.type && first.offset == next.offset) {
+            tokens.insert(tokens.end(), chunk.tokens.begin(), chunk.tokens.end());
+            owner = &chunk;
+            next = chunk.next;
+            continue;
+        }
+        ++relexed;
+        while(next.type != tok_eof && next.offset < chunk.end) {
+            tokens.push_back(next);
+            next = owner->lex->next();
+            to_global_atom(*owner, next);
+        }
+    }
+    tokens.push_back(next);
+
+    if(stats) {
+        stats->join_seconds = seconds_since(start);
+        stats->chunks = (unsigned)chunks.size();
+        stats->relexed_chunks = relexed;
+        for(auto& chunk : chunks) {
+            if(chunk.seconds > stats->max_chunk_seconds) {
+                stats->max_chunk_seconds = chunk.seconds;
+            }
+        }
+    }
+    return true;
+}
+
+static std::atomic<unsigned> tokenize_thread_count(1);
+
+void set_tokenize_thread_count(unsigned thread_count) {
+    tokenize_thread_count = thread_count;
+}
+unsigned get_tokenize_thread_count() {
+    return tokenize_thread_count;
+}
@@ -3,10 +3,47 @@
 
 #include <vector>
 #include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
 #include "token.hpp"
+#include "keywords.hpp"
+#include "punctuators.hpp"
+#include "char_class.hpp"
+#include "lexer_scan.hpp"
 
-// Tokenize buffer for preprocessing (include whitespace and newline)
-inline bool tokenize(const std::vector<char>& buffer, std::vector<token>& tokens, bool skip_space_and_newline = false) {
+// Returns the length of a line splice (backslash-newline) at buffer[i], 0 if there is none
+inline size_t splice_length(const char* buffer, size_t length, size_t i) {
+    if(buffer[i] != '\\' || i + 1 >= length) {
+        return 0;
+    }
+    if(buffer[i + 1] == '\n') {
+        return 2;
+    }
+    if(buffer[i + 1] == '\r' && i + 2 < length && buffer[i + 2] == '\n') {
+        return 3;
+    }
+    return 0;
+}
+
+// Into local if it's set, the process-wide table otherwise
+inline cppi::atom_t intern_identifier(const char* str, size_t length, cppi::local_interner* local = 0) {
+    if(memchr(str, '\\', length)) {
+        std::string name = remove_splices(str, length);
+        return local ? local->intern(name.data(), name.size()) : cppi::intern(name);
+    }
+    return local ? local->intern(str, length) : cppi::intern(str, length);
+}
+
+// Pull lexer over [begin, end) of a registered source, each next() lexes only as far as the token it returns
+// Tokens are for preprocessing by default (include whitespace and newline)
+// Line splices are skipped as they are encountered, so a token may contain one,
+// token::get_string() removes them
+// With classify_keywords identifiers that are keywords get their keyword token type,
+// leave it off for preprocessing, where keywords are plain identifiers
+// end must fit in 32 bits, tokenize() checks that
+// The preprocessor pulls the root file from one as it goes, and token pasting lexes each pasted pair with one
+// Included files are still lexed up front, the file cache shares their tokens and the directive index jumps over them
+class lexer {
     enum tokenizer_state {
         tstate_default,
         tstate_whitespace,
@@ -22,361 +59,324 @@ inline bool tokenize(const std::vector<char>& buffer, std::vector<token>& tokens
         tstate_comment_multiline,
         tstate_comment_multiline_end
     };
+
+    cppi::source_id file;
+    size_t begin;
+    size_t end;
+    const char* buffer; // begin of the range
+    size_t length;
+    bool skip_space_and_newline;
+    bool classify_keywords;
+    const cppi::lexer_scanners* scan;
+    cppi::local_interner* local_atoms = 0;
+
     tokenizer_state tstate = tstate_default;
     token tok;
+    token out;
+    bool has_token = false;
     size_t cid_start = 0;
     size_t cid = 0;
-    size_t line = 1, column = 0;
-    size_t column_start = 0; // starting column for current token
-    char c = buffer[cid];
-    auto advance = [&c, &buffer, &cid, &column](){
-        ++cid;
-        if (cid >= buffer.size()) {
-            c = '\0';
-        } else {
-            c = buffer[cid];
-            ++column;
+    size_t cid_end = 0; // end of the last consumed character, before any splice that follows it
+    char c = '\0';
+
+    // Consumes the current character and everything after it up to where run ends
+    void skip_run(size_t (*run)(const char*, size_t, size_t)) {
+        cid = run(buffer, cid + 1, length) - 1;
+    }
+    void skip_splices() {
+        size_t splice_len;
+        while(cid < length && (splice_len = splice_length(buffer, length, cid)) != 0) {
+            cid += splice_len;
         }
-    };
-    auto submit_token = [&tokens, &tok, &buffer, &cid, &cid_start, &column_start, &column, &line](token_type type){
-        tok.string = &buffer[cid_start];
-        tok.length = cid - cid_start;
+        c = cid < length ? buffer[cid] : '\0';
+    }
+    void advance() {
+        ++cid;
+        cid_end = cid;
+        skip_splices();
+    }
+    void submit_token(token_type type) {
+        tok.file = file;
+        tok.offset = (uint32_t)(begin + cid_start);
+        tok.length = (uint32_t)(cid_end - cid_start);
         tok.type = type;
-        tok.line = line;
-        tok.col = column_start;
-        if(type != tok_comment) tokens.push_back(tok);
+        if(type != tok_comment) {
+            assert(!has_token);
+            out = tok;
+            has_token = true;
+        }
+        tok.atom = cppi::atom_none;
         cid_start = cid;
+    }
+public:
+    lexer(
+        cppi::source_id file, size_t begin, size_t end,
+        bool skip_space_and_newline = false, bool classify_keywords = false
+    )
+    : file(file), begin(begin), end(end),
+    buffer(cppi::source_data(file) + begin), length(end - begin),
+    skip_space_and_newline(skip_space_and_newline), classify_keywords(classify_keywords),
+    scan(&cppi::get_lexer_scanners()) {
+        skip_splices();
+    }
 
-        column_start = column;
-    };
-    while(c != '\0') {
-        switch(tstate) {
-        case tstate_default:
-            tok.string = &buffer[cid];
-            tok.length = 0;
-            cid_start = cid;
-            column_start = column;
-            if(isspace(c)) {
-                tstate = tstate_whitespace;
-            } else if(isnewline(c)) {
-                advance();
-                if(!skip_space_and_newline) submit_token(tok_newline);
-                line++;
-                column = 0;
-            } else if(isalpha(c)) { tstate = tstate_identifier; }
-            else if(isnum(c)) { tstate = tstate_integer; }
-            else if(c == ';') { advance(); submit_token(tok_semicolon); }
-            else if(c == '{') { advance(); submit_token(tok_brace_l); }
-            else if(c == '}') { advance(); submit_token(tok_brace_r); }
-            else if(c == '[') { 
-                advance();
-                submit_token(tok_bracket_l);
-            } else if(c == ']') { 
-                advance();
-                submit_token(tok_bracket_r);
-            } else if(c == '(') { advance(); submit_token(tok_paren_l); }
-            else if(c == ')') { advance(); submit_token(tok_paren_r); }
-            else if(c == '#') { 
-                advance();
-                if(c == '#') {
+    // Atoms of identifiers are local to atoms until they are merged, for lexing on several threads
+    void set_local_interner(cppi::local_interner* atoms) {
+        local_atoms = atoms;
+    }
+    // For a range that starts inside a block comment, before the first next()
+    void resume_in_block_comment() {
+        // The comment state steps over the current character as the '*' that opened the comment,
+        // a '*' here may be the start of its end instead
+        tstate = c == '*' ? tstate_comment_multiline_end : tstate_comment_multiline;
+    }
+
+    // tok_eof at the end of the range, and on every call after that
+    token next() {
+        has_token = false;
+        while(!has_token && c != '\0') {
+            switch(tstate) {
+            case tstate_default:
+                cid_start = cid;
+                cid_end = cid;
+                switch(get_char_class(c)) {
+                case cc_space: tstate = tstate_whitespace; break;
+                case cc_newline:
                     advance();
-                    submit_token(tok_double_hash);
-                } else {
-                    submit_token(tok_hash);
-                } 
-            } else if(c == '\"') { tstate = tstate_string_constant; }
-            else if(c == '\'') { tstate = tstate_char_constant; }
-            else if(c == '=') {
+                    if(!skip_space_and_newline) submit_token(tok_newline);
+                    break;
+                case cc_ident: tstate = tstate_identifier; break;
+                case cc_digit: tstate = tstate_integer; break;
+                case cc_dot: tstate = tstate_dot; break;
+                case cc_slash: tstate = tstate_fwd_slash; break;
+                case cc_dquote: tstate = tstate_string_constant; break;
+                case cc_squote: tstate = tstate_char_constant; break;
+                case cc_punct: {
+                    // Longest match, a line splice may sit between the characters
+                    uint8_t state = 0;
+                    uint8_t next_state;
+                    while((next_state = punctuators.next[state][punctuators.char_index[(uint8_t)c]]) != 0) {
+                        state = next_state;
+                        advance();
+                    }
+                    submit_token(punctuators.type[state]);
+                    break;
+                }
+                default: advance(); break;
+                }
+                break;
+            case tstate_whitespace:
+                skip_run(scan->whitespace);
                 advance();
-                if(c == '=') {  // ==
-                    advance();
-                    submit_token(tok_equals);
-                } else {        // =
-                    submit_token(tok_assign);
+                if(!is_space_char(c)) {
+                    if(!skip_space_and_newline) submit_token(tok_whitespace);
+                    tstate = tstate_default;
                 }
-            } else if(c == '+') { // +, ++, +=
+                break;
+            case tstate_fwd_slash:
                 advance();
-                if(c == '+') {
-                    advance();
-                    submit_token(tok_incr);
+                if(c == '/') {
+                    tstate = tstate_comment_line;
+                } else if(c == '*') {
+                    tstate = tstate_comment_multiline;
                 } else if(c == '=') {
                     advance();
-                    submit_token(tok_plus_assign);
+                    submit_token(tok_fwd_slash_assign);
+                    tstate = tstate_default;
                 } else {
-                    submit_token(tok_plus);
+                    submit_token(tok_fwd_slash);
+                    tstate = tstate_default;
                 }
-            } else if(c == '-') { // -, --, -=, ->, ->*
-                advance();
-                if(c == '-') {
-                    advance();
-                    submit_token(tok_decr);
-                } else if(c == '=') {
-                    advance();
-                    submit_token(tok_minus_assign);
-                } else if(c == '>') {
-                    advance();
-                    if(c == '*') {
-                        advance();
-                        submit_token(tok_arrow_member);
-                    } else {
-                        submit_token(tok_arrow);
-                    }
-                }  
-            } else if(c == '*') { // *, *=
+                break;
+            case tstate_comment_line:
+                skip_run(scan->line_comment);
                 advance();
-                if(c == '=') {
-                    advance();
-                    submit_token(tok_asterisk_assign);
-                } else {
-                    submit_token(tok_asterisk);
+                if(c == '\n') {
+                    submit_token(tok_comment);
+                    tstate = tstate_default;
                 }
-            } else if(c == '/') {  // /, /=, //, /*
-                tstate = tstate_fwd_slash; 
-            } else if(c == '%') { // %, %=
+                break;
+            case tstate_comment_multiline:
+                skip_run(scan->block_comment);
                 advance();
-                if(c == '=') {
-                    advance();
-                    submit_token(tok_percent_assign);
-                } else {
-                    submit_token(tok_percent);
+                if(c == '*') {
+                    tstate = tstate_comment_multiline_end;
                 }
-            } else if(c == '!') { // !, !=
+                break;
+            case tstate_comment_multiline_end:
                 advance();
-                if(c == '=') {
+                if(c == '/') {
                     advance();
-                    submit_token(tok_excl_assign);
-                } else {
-                    submit_token(tok_excl);
+                    submit_token(tok_comment);
+                    tstate = tstate_default;
+                } else if(c != '*') {
+                    tstate = tstate_comment_multiline;
                 }
-            } else if(c == '<') { // <, <=, <=>, <<, <<=
+                break;
+            case tstate_identifier:
+                skip_run(scan->identifier);
                 advance();
-                if(c == '=') {
-                    advance();
-                    if(c == '>') {
-                        advance();
-                        submit_token(tok_three_way_comp);
-                    } else {
-                        submit_token(tok_less_assign);
-                    }
-                } else if(c == '<') {
-                    advance();
-                    if(c == '=') {
-                        advance();
-                        submit_token(tok_shift_left_assign);
+                if(!is_ident_char(c)) {
+                    tok.atom = intern_identifier(buffer + cid_start, cid_end - cid_start, local_atoms);
+                    if(classify_keywords) {
+                        submit_token(keyword_lookup(buffer + cid_start, cid_end - cid_start));
                     } else {
-                        submit_token(tok_shift_left);
+                        submit_token(tok_identifier);
                     }
-                } else {
-                    submit_token(tok_less);
+                    tstate = tstate_default;
                 }
-            } else if(c == '>') { // >, >=, >>, >>=
+                break;
+            case tstate_integer:
+                skip_run(scan->digits);
                 advance();
-                if(c == '=') {
-                    advance();
-                    submit_token(tok_more_assign);
-                } else if(c == '>') {
-                    advance();
-                    if(c == '=') {
-                        advance();
-                        submit_token(tok_shift_right_assign);
-                    } else {
-                        submit_token(tok_shift_right);
-                    }
+                if(is_digit_char(c)) {
+                    continue;
+                } else if(is_ident_start_char(c)) {
+                    submit_token(tok_int_literal);
+                    tstate = tstate_literal;
+                } else if(c == '.') {
+                    tstate = tstate_numreal;
                 } else {
-                    submit_token(tok_more);
+                    submit_token(tok_int_literal);
+                    tstate = tstate_default;
                 }
-            } else if(c == '&') { // &, &&, &=
+                break;
+            case tstate_numreal:
+                skip_run(scan->digits);
                 advance();
-                if(c == '&') {
-                    advance();
-                    submit_token(tok_double_amp);
-                } else if(c == '=') {
-                    advance();
-                    submit_token(tok_amp_assign);
+                if(is_digit_char(c)) {
+                    continue;
+                } else if(is_ident_start_char(c)) {
+                    submit_token(tok_float_literal);
+                    tstate = tstate_literal;
                 } else {
-                    submit_token(tok_amp);
+                    submit_token(tok_float_literal);
+                    tstate = tstate_default;
                 }
-            } else if(c == '|') { // |, ||, |=
+                break;
+            case tstate_dot:
                 advance();
-                if(c == '|') {
+                if(is_digit_char(c)) {
+                    tstate = tstate_numreal;
+                } else if(c == '*') {
                     advance();
-                    submit_token(tok_double_pipe);
-                } else if(c == '='){
+                    submit_token(tok_dot_asterisk);
+                    tstate = tstate_default;
+                } else if(c == '.') {
                     advance();
-                    submit_token(tok_pipe_assign);
+                    if(c == '.') {
+                        advance();
+                        submit_token(tok_elipsis);
+                        tstate = tstate_default;
+                    } else {
+                        assert(false);
+                    }
                 } else {
-                    submit_token(tok_pipe);
+                    submit_token(tok_dot);
+                    tstate = tstate_default;
                 }
-            } else if(c == '~') { // ~
-                advance();
-                submit_token(tok_tilde);
-            } else if(c == '^') { // ^, ^=
+                break;
+            case tstate_literal:
                 advance();
-                if(c == '=') {
-                    advance();
-                    submit_token(tok_hat_assign);
+                if(is_ident_start_char(c)) {
+                    continue;
                 } else {
-                    submit_token(tok_hat);
+                    submit_token(tok_literal);
+                    tstate = tstate_default;
                 }
-            } else if(c == ',') { // ,
-                advance();
-                submit_token(tok_comma);
-            } else if(c == '?') { // ?
+                break;
+            case tstate_string_constant:
+                skip_run(scan->string_body);
                 advance();
-                submit_token(tok_question);
-            } else if(c == ':') { // :, ::
-                advance();
-                if(c == ':') {
+                if(c == '\\') {
+                    // Escaped character is taken as is, even a quote
                     advance();
-                    submit_token(tok_double_colon);
+                    continue;
+                } else if(c != '\"' && c != '\n' && c != '\0') {
+                    continue;
                 } else {
-                    submit_token(tok_colon);
-                }
-            } else if(c == '.') { tstate = tstate_dot; }
-            else if(c == '/') { tstate = tstate_fwd_slash; }
-            else advance();
-            break;
-        case tstate_whitespace:
-            advance();
-            if(!isspace(c)) {
-                if(!skip_space_and_newline) submit_token(tok_whitespace);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_fwd_slash:
-            advance();
-            if(c == '/') {
-                tstate = tstate_comment_line;
-            } else if(c == '*') {
-                tstate = tstate_comment_multiline;
-            } else if(c == '=') {
-                advance();
-                submit_token(tok_fwd_slash_assign);
-                tstate = tstate_default;
-            } else {
-                submit_token(tok_fwd_slash);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_comment_line:
-            advance();
-            if(c == '\n') {
-                submit_token(tok_comment);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_comment_multiline:
-            advance();
-            if(c == '*') {
-                advance();
-                if(c == '/') {
                     advance();
-                    submit_token(tok_comment);
+                    submit_token(tok_string_constant);
                     tstate = tstate_default;
                 }
-            }
-            break;
-        case tstate_identifier:
-            advance();
-            if(!isalphanum(c)) {
-                submit_token(tok_identifier);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_integer:
-            advance();
-            if(isnum(c)) {
-                continue;
-            } else if(isalpha(c)) {
-                submit_token(tok_int_literal);
-                tstate = tstate_literal;
-            } else if(c == '.') {
-                tstate = tstate_numreal;
-            } else {
-                submit_token(tok_int_literal);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_numreal:
-            advance();
-            if(isnum(c)) {
-                continue;
-            } else if(isalpha(c)) {
-                submit_token(tok_float_literal);
-                tstate = tstate_literal;
-            } else {
-                submit_token(tok_float_literal);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_dot:
-            advance();
-            if(isnum(c)) {
-                tstate = tstate_numreal;
-            } else if(c == '*') {
+                break;
+            case tstate_char_constant:
+                skip_run(scan->char_body);
                 advance();
-                submit_token(tok_dot_asterisk);
-                tstate = tstate_default;
-            } else if(c == '.') {
-                advance();
-                if(c == '.') {
+                if(c == '\\') {
                     advance();
-                    submit_token(tok_elipsis);
-                    tstate = tstate_default;
+                    continue;
+                } else if(c != '\'' && c != '\n' && c != '\0') {
+                    continue;
                 } else {
-                    assert(false);
-                }
-            } else {
-                submit_token(tok_dot);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_literal:
-            advance();
-            if(isalpha(c)) {
-                continue;
-            } else {
-                submit_token(tok_literal);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_string_constant:
-            advance();
-            if(c == '\\') {
-                advance();
-                if(c == '"') {
                     advance();
-                    continue;
+                    submit_token(tok_char_constant);
+                    tstate = tstate_default;
                 }
-                continue;
-            } else if(c != '\"' && !isnewline(c) && !iseof(c)) {
-                continue;
-            } else {
-                advance();
-                submit_token(tok_string_constant);
-                tstate = tstate_default;
-            }
-            break;
-        case tstate_char_constant:
-            advance();
-            if(c != '\'' && !isnewline(c) && !iseof(c)) {
-                continue;
-            } else {
-                advance();
-                submit_token(tok_char_constant);
-                tstate = tstate_default;
-            }
-            break;
-        };
-    }
-    
-    {
-        token tok;
-        tok.type = tok_eof;
-        tokens.push_back(tok);
+                break;
+            };
+        }
+        if(!has_token) {
+            out = token();
+            out.type = tok_eof;
+            out.file = file;
+            out.offset = (uint32_t)end;
+        }
+        return out;
     }
+};
 
+// Whole range at once, ends with tok_eof
+inline bool tokenize(
+    cppi::source_id file, size_t begin, size_t end, std::vector<token>& tokens,
+    bool skip_space_and_newline = false, bool classify_keywords = false
+) {
+    if(end > UINT32_MAX) {
+        printf("%s is too large, token offsets are 32 bit\n", cppi::source_name(file).c_str());
+        return false;
+    }
+    lexer lex(file, begin, end, skip_space_and_newline, classify_keywords);
+    while(true) {
+        tokens.push_back(lex.next());
+        if(tokens.back().type == tok_eof) {
+            break;
+        }
+    }
     return true;
 }
+inline bool tokenize(
+    cppi::source_id file, std::vector<token>& tokens,
+    bool skip_space_and_newline = false, bool classify_keywords = false
+) {
+    return tokenize(file, 0, cppi::source_size(file), tokens, skip_space_and_newline, classify_keywords);
+}
+
+// Smaller sources are not worth starting threads for
+const size_t PARALLEL_TOKENIZE_MIN_SIZE = 2 * 1024 * 1024;
+
+// Where the time of one tokenize_parallel() went, for benchmarks
+struct tokenize_parallel_stats {
+    bool serial = false;           // in: lex the chunks one after another, so each is timed on a core of its own
+    double prescan_seconds = 0;    // finding the chunks that start inside a block comment, on one thread
+    double lex_seconds = 0;        // all chunks
+    double max_chunk_seconds = 0;  // slowest chunk, what lexing takes with a core for every chunk
+    double join_seconds = 0;
+    unsigned chunks = 0;
+    unsigned relexed_chunks = 0;   // lexed again by the lexer of the chunk before, 0 unless the pre-scan was wrong
+};
+
+// Same tokens as tokenize(), large sources are split at line starts and the pieces lexed on separate threads
+// Identifiers are interned per piece and merged once a piece is done
+// thread_count 0 means one per core
+bool tokenize_parallel(
+    cppi::source_id file, std::vector<token>& tokens,
+    bool skip_space_and_newline = false, bool classify_keywords = false,
+    unsigned thread_count = 0, tokenize_parallel_stats* stats = 0
+);
+
+// Threads file_cache passes to tokenize_parallel() for included files, 0 means one per core
+// 1 by default, so sources are lexed on the calling thread, lexing on several threads hasn't been faster yet
+void set_tokenize_thread_count(unsigned thread_count);
+unsigned get_tokenize_thread_count();
 
 #endif
@@ -1,6 +1,7 @@
 
 #include <string>
 #include "cppi/cppi.hpp"
+#include "cppi/tokenize.hpp"
 
 #include <windows.h>
 
@@ -13,10 +14,36 @@ int main(int argc, char** argv) {
         return 1;
     }
     std::string fname = argv[1];
+    // --pp writes the preprocessed text next to the file
+    // --brackets parses with the bracket index instead of the node tree
+    // --packrat memoizes rule results while parsing
+    // --parallel-lex lexes large included files on one thread per core
+    bool dump_pp = false;
+    bool bracket_index = false;
+    bool packrat = false;
+    bool parallel_lex = false;
+    for(int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg == "--pp") {
+            dump_pp = true;
+        } else if(arg == "--brackets") {
+            bracket_index = true;
+        } else if(arg == "--packrat") {
+            packrat = true;
+        } else if(arg == "--parallel-lex") {
+            parallel_lex = true;
+        }
+    }
 
     cppi::set_log_callback(&log_msg);
+    if(parallel_lex) {
+        set_tokenize_thread_count(0);
+    }
 
     cppi::context ctx;
+    ctx.get_preprocessor_context().set_dump_text(dump_pp);
+    ctx.set_bracket_index_mode(bracket_index);
+    ctx.set_packrat(packrat);
     if(!ctx.parse(fname.c_str())) {
         return 1;
     }
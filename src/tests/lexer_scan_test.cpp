@@ -0,0 +1,275 @@
+// Differential test of the SSE2 and AVX2 lexer scanners against the scalar ones
+// Every scanner is run from every start index of a buffer, and whole buffers are tokenized at every level,
+// on random buffers and on edge cases: splices, unterminated comments and strings, runs across vector widths
+// Levels the cpu doesn't support are skipped, exits with 1 on the first mismatch
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+
+#include "cppi/tokenize.hpp"
+#include "cppi/lexer_scan.hpp"
+#include "cppi/source.hpp"
+
+using namespace cppi;
+
+static const char* level_name(simd_level level) {
+    switch(level) {
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+static std::string printable(const std::string& str) {
+    std::string r;
+    for(char c : str) {
+        if(c == '\n') r += "\\n";
+        else if(c == '\r') r += "\\r";
+        else if(c == '\t') r += "\\t";
+        else if(c == '\\') r += "\\\\";
+        else if((unsigned char)c < 0x20 || (unsigned char)c >= 0x7F) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\x%02X", (unsigned char)c);
+            r += buf;
+        } else r += c;
+    }
+    return r;
+}
+
+static const char* scanner_names[] = {
+    "identifier", "digits", "whitespace", "line_comment", "block_comment", "string_body", "char_body"
+};
+static void get_scanner_list(const lexer_scanners& s, size_t (*list[7])(const char*, size_t, size_t)) {
+    list[0] = s.identifier;
+    list[1] = s.digits;
+    list[2] = s.whitespace;
+    list[3] = s.line_comment;
+    list[4] = s.block_comment;
+    list[5] = s.string_body;
+    list[6] = s.char_body;
+}
+
+static std::vector<simd_level> levels;
+
+// Copied into a buffer of exactly its size, so reads past the end show up under a sanitizer
+static bool check_scanners(const std::string& str) {
+    std::unique_ptr<char[]> data(new char[str.size() ? str.size() : 1]);
+    memcpy(data.get(), str.data(), str.size());
+
+    size_t (*scalar[7])(const char*, size_t, size_t);
+    set_lexer_simd_level(SIMD_NONE);
+    get_scanner_list(get_lexer_scanners(), scalar);
+    for(simd_level level : levels) {
+        size_t (*simd[7])(const char*, size_t, size_t);
+        set_lexer_simd_level(level);
+        get_scanner_list(get_lexer_scanners(), simd);
+        for(int k = 0; k < 7; ++k) {
+            for(size_t i = 0; i <= str.size(); ++i) {
+                size_t expected = scalar[k](data.get(), i, str.size());
+                size_t result = simd[k](data.get(), i, str.size());
+                if(expected != result) {
+                    printf(
+                        "FAIL %s %s from %d: scalar %d, got %d\n  \"%s\"\n",
+                        level_name(level), scanner_names[k], (int)i, (int)expected, (int)result,
+                        printable(str).c_str()
+                    );
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static bool lex(const char* data, size_t size, simd_level level, bool classify_keywords, std::vector<token>& tokens) {
+    set_lexer_simd_level(level);
+    source_id file = register_source(data, size, "lexer_scan_test");
+    if(file == source_none) {
+        return false;
+    }
+    tokens.clear();
+    bool ok = tokenize(file, 0, size, tokens, false, classify_keywords);
+    // Compared by offset, not by text, so the source can go before the tokens are looked at
+    release_source(file);
+    return ok;
+}
+
+static bool check_tokens(const std::string& str) {
+    std::unique_ptr<char[]> data(new char[str.size() ? str.size() : 1]);
+    memcpy(data.get(), str.data(), str.size());
+
+    for(int classify = 0; classify < 2; ++classify) {
+        std::vector<token> expected;
+        if(!lex(data.get(), str.size(), SIMD_NONE, classify != 0, expected)) {
+            printf("FAIL can't tokenize\n  \"%s\"\n", printable(str).c_str());
+            return false;
+        }
+        for(simd_level level : levels) {
+            std::vector<token> result;
+            if(!lex(data.get(), str.size(), level, classify != 0, result)) {
+                printf("FAIL %s can't tokenize\n  \"%s\"\n", level_name(level), printable(str).c_str());
+                return false;
+            }
+            size_t count = std::max(expected.size(), result.size());
+            for(size_t i = 0; i < count; ++i) {
+                bool same = i < expected.size() && i < result.size()
+                    && expected[i].type == result[i].type
+                    && expected[i].offset == result[i].offset
+                    && expected[i].length == result[i].length
+                    && expected[i].atom == result[i].atom;
+                if(same) {
+                    continue;
+                }
+                printf("FAIL %s token %d differs", level_name(level), (int)i);
+                if(i < expected.size()) {
+                    printf(", scalar type %d at %d+%d", (int)expected[i].type, (int)expected[i].offset, (int)expected[i].length);
+                }
+                if(i < result.size()) {
+                    printf(", got type %d at %d+%d", (int)result[i].type, (int)result[i].offset, (int)result[i].length);
+                }
+                printf("\n  \"%s\"\n", printable(str).c_str());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool check(const std::string& str) {
+    return check_scanners(str) && check_tokens(str);
+}
+
+// xorshift, fixed seed so failures reproduce
+static uint32_t rng_state = 0x9E3779B9u;
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Mostly the characters that start or end runs
+static std::string random_buffer(size_t length) {
+    static const char alphabet[] =
+        "abcxyzABCXYZ_019 \t\r\n\n\\\\\"\"''//**#.+-<>=;:,(){}[]";
+    std::string str;
+    for(size_t i = 0; i < length; ++i) {
+        uint32_t r = rng() % 100;
+        if(r < 2) {
+            str.push_back('\0');
+        } else if(r < 4) {
+            str.push_back((char)(0x80 + rng() % 0x80));
+        } else if(r < 6) {
+            str.push_back((char)(1 + rng() % 0x1F));
+        } else {
+            str.push_back(alphabet[rng() % (sizeof(alphabet) - 1)]);
+        }
+        // The lexer asserts on ".." that isn't "...", keep dots apart, also across a splice
+        size_t n = str.size();
+        if(n >= 2 && str[n - 1] == '.' && (str[n - 2] == '.' || str[n - 2] == '\n' || str[n - 2] == '\r')) {
+            str[n - 1] = 'x';
+        }
+    }
+    return str;
+}
+
+// Sources that start, end or are interrupted next to the edges of 16 and 32 byte blocks
+static void edge_cases(std::vector<std::string>& cases) {
+    const char* constructs[] = {
+        "identifier_\\\nafter_splice",
+        "ident\\\r\nafter_crlf_splice",
+        "12345\\\n67890",
+        "\"string \\\n with splice\"",
+        "'c\\\nh'",
+        "// line comment \\\n continued by a splice\nnext",
+        "/* block *\\\n/ still comment */x",
+        "/* block ** / * never closed",
+        "/* block ending in star *",
+        "\"never closed string",
+        "\"string ending in backslash\\",
+        "'never closed char",
+        "\"string with newline\nx\"",
+        "// comment at the very end",
+        "trailing backslash\\",
+        "trailing splice\\\n",
+        "\"escaped \\\" quote\" x",
+        "'\\'' x",
+        " \t\r \t\r \t\r \t\r \t\r \t\r \t\r \t\r \t\r \t\r \t\r \t\rx",
+        "\xC3\xA4identifier\xFF \"\x80\x90\" /* \xFE */",
+    };
+    std::vector<std::string> bodies(std::begin(constructs), std::end(constructs));
+    // '\0' ends every run
+    const char with_nul[] = "a\0b \"c\0d\" /* e\0f */ // g\0h\n";
+    bodies.push_back(std::string(with_nul, sizeof(with_nul) - 1));
+    for(const std::string& body : bodies) {
+        for(size_t pad = 0; pad <= 40; ++pad) {
+            cases.push_back(std::string(pad, 'p') + " " + body);
+            cases.push_back(std::string(pad, ' ') + body);
+            cases.push_back(body + std::string(pad, 'q'));
+        }
+    }
+    // Runs of every length around the block sizes, cut by the character that ends them and by the end of the buffer
+    const char* run_chars = "a1 /\"'";
+    for(const char* rc = run_chars; *rc; ++rc) {
+        for(size_t length = 0; length <= 70; ++length) {
+            std::string run;
+            switch(*rc) {
+            case '/': run = "/*" + std::string(length, 'x'); break;
+            case '"': run = "\"" + std::string(length, 'x'); break;
+            case '\'': run = "'" + std::string(length, 'x'); break;
+            default: run = std::string(length, *rc); break;
+            }
+            cases.push_back(run);
+            cases.push_back(run + "\\\nz");
+            cases.push_back(run + "*/;\"';\n");
+            cases.push_back("//" + std::string(length, 'c'));
+            cases.push_back("//" + std::string(length, 'c') + "\n" + run);
+        }
+    }
+    cases.push_back("");
+    cases.push_back("\\");
+    cases.push_back("\\\n");
+    cases.push_back("\\\r");
+    cases.push_back("\\\r\n");
+    cases.push_back(std::string(1, '\0'));
+}
+
+int main() {
+    simd_level best = best_simd_level();
+    for(int level = SIMD_SSE2; level <= SIMD_AVX2; ++level) {
+        if(level <= best) {
+            levels.push_back((simd_level)level);
+        } else {
+            printf("%s not supported, skipped\n", level_name((simd_level)level));
+        }
+    }
+
+    std::vector<std::string> cases;
+    edge_cases(cases);
+    size_t edge_count = cases.size();
+    for(int i = 0; i < 3000; ++i) {
+        cases.push_back(random_buffer(rng() % 200));
+    }
+    for(int i = 0; i < 100; ++i) {
+        cases.push_back(random_buffer(1000 + rng() % 3000));
+    }
+
+    for(auto& str : cases) {
+        if(!check(str)) {
+            set_lexer_simd_level(best);
+            return 1;
+        }
+    }
+    set_lexer_simd_level(best);
+    printf(
+        "OK, %d edge cases and %d random buffers match the scalar lexer at %d simd levels\n",
+        (int)edge_count, (int)(cases.size() - edge_count), (int)levels.size()
+    );
+    return 0;
+}